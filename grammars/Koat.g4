@@ -24,7 +24,9 @@ lb      :       expr;
 ub      :       expr;
 cond    :       CONDSEP formula | LBRACK formula RBRACK;
 
-// arithmetic expressions
+// Arithmetic expressions and formulas are left-recursive, so that the order of the alternatives defines the
+// precedences. SLL prediction has sufficed for them so far (see ITSParser), so they are not split into one rule per
+// precedence level.
 expr    :       LPAR expr RPAR | MINUS expr | expr EXP expr | expr TIMES expr | expr PLUS expr | expr MINUS expr | var | INT;
 
 // formulas
@@ -1,22 +1,27 @@
 #include "KoatParseVisitor.h"
 #include "its.hpp"
 
+#include <algorithm>
 #include <any>
 
 using relop_type = RelOp;
-using fs_type = std::string;
+using fs_type = Symbol;
 using lhs_type = Lhs;
 using com_type = std::vector<Rhs>;
 using cond_type = Formula;
 using rhs_type = Rhs;
 using expr_type = Expr;
-using var_type = std::string;
+using var_type = Symbol;
 using lit_type = Rel;
 using formula_type = Formula;
 
+ITS& KoatParseVisitor::result() {
+    return its;
+}
+
 antlrcpp::Any KoatParseVisitor::visitMain(KoatParser::MainContext *ctx) {
     visitChildren(ctx);
-    return its;
+    return {};
 }
 
 antlrcpp::Any KoatParseVisitor::visitGoal(KoatParser::GoalContext *ctx) {
@@ -43,39 +48,24 @@ antlrcpp::Any KoatParseVisitor::visitTranss(KoatParser::TranssContext *ctx) {
 }
 
 antlrcpp::Any KoatParseVisitor::visitVar(KoatParser::VarContext *ctx) {
-    return ctx->getText();
+    return Symbol(ctx->getText());
 }
 
 antlrcpp::Any KoatParseVisitor::visitFs(KoatParser::FsContext *ctx) {
-    return ctx->getText();
+    return Symbol(ctx->getText());
 }
 
 antlrcpp::Any KoatParseVisitor::visitTrans(KoatParser::TransContext *ctx) {
     Rule r;
     r.lhs = std::any_cast<lhs_type>(visit(ctx->lhs()));
-    const auto rhss = std::any_cast<com_type>(visit(ctx->com()));
+    auto rhss = std::any_cast<com_type>(visit(ctx->com()));
     if (rhss.size() > 1) {
         throw std::invalid_argument("Com-symbols are not supported");
     }
-    r.rhs = rhss.front();
+    r.rhs = std::move(rhss.front());
     r.cond = ctx->cond() ? std::any_cast<cond_type>(visit(ctx->cond())) : True;
-    std::set<std::string> bound_vars {r.lhs.args.begin(), r.lhs.args.end()};
-    for (const auto &arg: r.rhs.args) {
-        collect_vars(arg, bound_vars);
-    }
-    std::set<std::string> cond_vars;
-    collect_vars(r.cond, cond_vars);
-    Exists ex;
-    for (const auto &x: cond_vars) {
-        if (!bound_vars.contains(x)) {
-            ex.vars.push_back(x);
-        }
-    }
-    if (!ex.vars.empty()) {
-        ex.matrix = std::make_shared<Formula>(r.cond);
-        r.cond = ex;
-    }
-    its.rules.push_back(r);
+    quantify_free_vars(r);
+    its.add_rule(std::move(r));
     return {};
 }
 
@@ -133,7 +123,7 @@ antlrcpp::Any KoatParseVisitor::visitExpr(KoatParser::ExprContext *ctx) {
         if (ctx->expr().size() == 2) {
             const auto arg1 = std::any_cast<expr_type>(visit(ctx->expr(0)));
             const auto arg2 = std::any_cast<expr_type>(visit(ctx->expr(1)));
-            return mk_minus({arg1, arg2});
+            return mk_arith_app(ArithOp::Minus, arg1, arg2);
         } else {
             const auto res = std::any_cast<expr_type>(visit(ctx->expr(0)));
             return mk_unary_minus(res);
@@ -142,17 +132,12 @@ antlrcpp::Any KoatParseVisitor::visitExpr(KoatParser::ExprContext *ctx) {
         const auto arg1 = std::any_cast<expr_type>(visit(ctx->expr(0)));
         const auto arg2 = std::any_cast<expr_type>(visit(ctx->expr(1)));
         if (ctx->TIMES()) {
-            return mk_times({arg1, arg2});
+            return mk_arith_app(ArithOp::Times, arg1, arg2);
         } else if (ctx->PLUS()) {
-            return mk_plus({arg1, arg2});
+            return mk_arith_app(ArithOp::Plus, arg1, arg2);
         } else if (ctx->EXP()) {
             if (std::holds_alternative<long>(arg2)) {
-                const auto exponent {std::get<long>(arg2)};
-                std::vector<expr_type> args;
-                for (long i = 0; i < exponent; ++i) {
-                    args.push_back(arg1);
-                }
-                return mk_times(args);
+                return mk_pow(arg1, std::max(std::get<long>(arg2), 0L));
             }
         }
     }
@@ -168,9 +153,9 @@ antlrcpp::Any KoatParseVisitor::visitFormula(KoatParser::FormulaContext *ctx) {
         const auto arg1 = std::any_cast<formula_type>(visit(ctx->formula(0)));
         const auto arg2 = std::any_cast<formula_type>(visit(ctx->formula(1)));
         if (ctx->AND()) {
-            return mk_and({arg1, arg2});
+            return mk_bool_app(BoolOp::And, arg1, arg2);
         } else if (ctx->OR()) {
-            return mk_or({arg1, arg2});
+            return mk_bool_app(BoolOp::Or, arg1, arg2);
         }
     }
     throw std::invalid_argument("failed to parse formula " + ctx->getText());
@@ -14,6 +14,8 @@ class  KoatParseVisitor : public KoatVisitor {
 
 public:
 
+    ITS& result();
+
     virtual antlrcpp::Any visitMain(KoatParser::MainContext *ctx) override;
     virtual antlrcpp::Any visitGoal(KoatParser::GoalContext *ctx) override;
     virtual antlrcpp::Any visitStart(KoatParser::StartContext *ctx) override;
@@ -0,0 +1,74 @@
+#include "arena.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+    thread_local Arena *current_arena {nullptr};
+
+    // larger blocks do not pay off
+    constexpr size_t max_block_size {1 << 20};
+
+}
+
+void* Arena::allocate_block(const size_t size, const size_t align) {
+    // the remainder of the current block is wasted, so the blocks grow to keep that negligible
+    const auto new_size {std::max(block_size, size + align)};
+    blocks.push_back(std::make_unique_for_overwrite<std::byte[]>(new_size));
+    pos = blocks.back().get();
+    end = pos + new_size;
+    block_size = std::min(2 * block_size, max_block_size);
+    return allocate(size, align);
+}
+
+void Arena::insert(const Entry &e) {
+    // at most half of the slots are used
+    if (2 * (node_count + 1) > slots.size()) {
+        std::vector<Entry> old(std::max<size_t>(2 * slots.size(), 1 << 10));
+        old.swap(slots);
+        node_count = 0;
+        for (const auto &x: old) {
+            if (x.node) {
+                insert(x);
+            }
+        }
+    }
+    const auto mask {slots.size() - 1};
+    auto i {e.hash & mask};
+    while (slots[i].node) {
+        i = (i + 1) & mask;
+    }
+    slots[i] = e;
+    ++node_count;
+}
+
+void Arena::adopt(Arena &other) {
+    std::move(other.blocks.begin(), other.blocks.end(), std::back_inserter(blocks));
+    other.blocks.clear();
+    // nodes that are equal to one of ours are kept, but cannot be found anymore
+    for (const auto &e: other.slots) {
+        if (e.node) {
+            insert(e);
+        }
+    }
+    other.slots.clear();
+    other.node_count = 0;
+    other.pos = nullptr;
+    other.end = nullptr;
+}
+
+Arena& Arena::current() {
+    if (!current_arena) {
+        throw std::logic_error("no arena for allocating expressions");
+    }
+    return *current_arena;
+}
+
+ArenaScope::ArenaScope(Arena &arena): previous(current_arena) {
+    current_arena = &arena;
+}
+
+ArenaScope::~ArenaScope() {
+    current_arena = previous;
+}
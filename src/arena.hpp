@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A bump allocator that owns the nodes of the expressions and formulas of an ITS.
+ *
+ * All memory is released at once when the arena is destroyed, so only trivially destructible objects can be allocated.
+ * An arena is not thread-safe: nodes are allocated in the arena of the current thread (see ArenaScope), so concurrent
+ * parsers use one arena each, and the results are merged via adopt.
+ */
+class Arena {
+
+    // a node allocated via unique, where equal is specific to its type
+    struct Entry {
+        const void *node;
+        size_t hash;
+        bool (*equal)(const void*, const void*);
+    };
+
+    // spreads the entropy of hash values over all bits, as the slot is determined by the lowest ones
+    static size_t mix(size_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        return h;
+    }
+
+    template <class T>
+    static bool equal(const void *x, const void *y) {
+        return *static_cast<const T*>(x) == *static_cast<const T*>(y);
+    }
+
+    std::vector<std::unique_ptr<std::byte[]>> blocks;
+    std::byte *pos {nullptr};
+    std::byte *end {nullptr};
+    size_t block_size {1 << 12};
+    // open addressing with linear probing, where unused slots have no node
+    std::vector<Entry> slots;
+    size_t node_count {0};
+
+    void* allocate_block(const size_t size, const size_t align);
+    void insert(const Entry &e);
+
+public:
+
+    // whether the mk_* functions of its.hpp keep nested applications of associative operators that are built in this
+    // arena as they are
+    bool preserve_shape {false};
+
+    Arena() = default;
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(const size_t size, const size_t align) {
+        const auto addr {(reinterpret_cast<uintptr_t>(pos) + align - 1) & ~(align - 1)};
+        if (addr + size > reinterpret_cast<uintptr_t>(end)) {
+            return allocate_block(size, align);
+        }
+        pos = reinterpret_cast<std::byte*>(addr + size);
+        return reinterpret_cast<void*>(addr);
+    }
+
+    template <class T, class... Args>
+    const T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>);
+        return new (allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+    }
+
+    template <class T>
+    std::span<const T> copy(const std::span<const T> xs) {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+        if (xs.empty()) {
+            return {};
+        }
+        const auto res {static_cast<T*>(allocate(sizeof(T) * xs.size(), alignof(T)))};
+        std::uninitialized_copy(xs.begin(), xs.end(), res);
+        return {res, xs.size()};
+    }
+
+    /**
+     * Hash-consing: returns the node that has been allocated via unique and is equal to node, if any, and otherwise
+     * allocates persist(node), which has to copy everything that node refers to into the arena. Nodes are compared via
+     * operator== and hashed via std::hash, so their children have to be hash-consed already.
+     */
+    template <class T, class Persist>
+    const T* unique(const T &node, Persist &&persist) {
+        const auto hash {mix(std::hash<T>{}(node))};
+        if (!slots.empty()) {
+            const auto mask {slots.size() - 1};
+            for (auto i = hash & mask; slots[i].node; i = (i + 1) & mask) {
+                if (slots[i].hash == hash && slots[i].equal == &equal<T> && equal<T>(slots[i].node, &node)) {
+                    return static_cast<const T*>(slots[i].node);
+                }
+            }
+        }
+        const auto res {make<T>(persist(node))};
+        insert(Entry{res, hash, &equal<T>});
+        return res;
+    }
+
+    /**
+     * takes over the memory of other, which must not be used for allocations anymore
+     */
+    void adopt(Arena &other);
+
+    /**
+     * the arena of the current thread, see ArenaScope
+     */
+    static Arena& current();
+
+};
+
+/**
+ * Makes an arena the current one of this thread until the scope is left.
+ */
+class ArenaScope {
+
+    Arena *previous;
+
+public:
+
+    explicit ArenaScope(Arena &arena);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+};
@@ -1,45 +1,152 @@
 #include "ariparser.hpp"
 #include "util.hpp"
+#include "mappedfile.hpp"
+#include "parallel.hpp"
 #include <algorithm>
 #include <stdexcept>
-#include <fstream>
-#include <iostream>
+#include <charconv>
+#include <optional>
 
-std::string unescape(const std::string &s) {
+Symbol unescape(std::string_view s) {
     if (s.starts_with("|")) {
-        return s.substr(1, s.length() - 2);
+        return Symbol(s.substr(1, s.length() - 2));
     } else {
-        return s;
+        return Symbol(s);
     }
 }
 
-ITS AriParser::parse(sexpresso::Sexp &s) {
+namespace {
+
+    // the connectives are recognized by their length and first character, rather than by a chain of string comparisons
+
+    std::optional<RelOp> rel_op(const std::string_view s) {
+        switch (s.size()) {
+            case 1:
+                switch (s[0]) {
+                    case '=': return RelOp::Eq;
+                    case '<': return RelOp::Lt;
+                    case '>': return RelOp::Gt;
+                }
+                break;
+            case 2:
+                if (s[1] == '=') {
+                    switch (s[0]) {
+                        case '<': return RelOp::Leq;
+                        case '>': return RelOp::Geq;
+                    }
+                }
+                break;
+            case 8:
+                if (s == "distinct") {
+                    return RelOp::Neq;
+                }
+                break;
+        }
+        return {};
+    }
+
+    std::optional<BoolOp> bool_op(const std::string_view s) {
+        switch (s.size()) {
+            case 2:
+                if (s == "or") {
+                    return BoolOp::Or;
+                }
+                break;
+            case 3:
+                if (s == "and") {
+                    return BoolOp::And;
+                } else if (s == "not") {
+                    return BoolOp::Not;
+                }
+                break;
+        }
+        return {};
+    }
+
+    std::optional<ArithOp> arith_op(const std::string_view s) {
+        if (s.size() == 1) {
+            switch (s[0]) {
+                case '+': return ArithOp::Plus;
+                case '-': return ArithOp::Minus;
+                case '*': return ArithOp::Times;
+            }
+        }
+        return {};
+    }
+
+    long parse_int(const std::string_view str) {
+        long res;
+        const auto [ptr, err] {std::from_chars(str.data(), str.data() + str.size(), res)};
+        if (err != std::errc() || ptr != str.data() + str.size()) {
+            throw std::invalid_argument("invalid integer " + std::string{str});
+        }
+        return res;
+    }
+
+}
+
+ITS AriParser::parse(sexpresso::Reader &reader) {
     ITS its;
-    for (unsigned i = 0; i < s.childCount(); ++i) {
-        auto c {s.getChild(i)};
-        auto fst {c.getChild(0)};
-        auto str {fst.str()};
+    its.arena->preserve_shape = preserve_shape;
+    const ArenaScope scope(*its.arena);
+    // only materialize one top-level form at a time
+    sexpresso::Sexp c;
+    while (reader.read(c)) {
+        // like read, everything but rules and the entrypoint is ignored
+        if (!c.isSexp() || c.childCount() == 0 || !c.getChild(0).isString()) {
+            continue;
+        }
+        const auto str {c.getChild(0).str()};
         if (str == "entrypoint") {
+            if (c.childCount() < 2 || !c.getChild(1).isString()) {
+                throw std::invalid_argument("parsing failed: expected symbol");
+            }
             its.init = unescape(c.getChild(1).str());
         } else if (str == "rule") {
-            its.rules.push_back(parse_rule(c));
+            its.add_rule(parse_rule(c));
         }
     }
+    if (reader.peek().kind != sexpresso::EventKind::END) {
+        throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "unbalanced parentheses" : reader.error()));
+    }
     return its;
 }
 
+// The generic parser accepts exactly the same inputs as the fused one and yields the same ITS, so that the result does
+// not depend on --parser.
+
 Rule AriParser::parse_rule(sexpresso::Sexp &s) {
+    if (s.childCount() < 3) {
+        throw std::invalid_argument("parsing failed: unexpected token");
+    }
     Rule r;
     r.lhs = parse_lhs(s.getChild(1));
     r.rhs = parse_rhs(s.getChild(2));
-    r.cond = s.childCount() > 3 ? parse_formula(s.getChild(4)) : True;
+    r.cond = True;
+    // everything after the guard is ignored
+    if (s.childCount() > 3 && s.getChild(3).isString() && s.getChild(3).str() == ":guard") {
+        if (s.childCount() == 4) {
+            throw std::invalid_argument("parsing failed: expected formula");
+        }
+        r.cond = parse_formula(s.getChild(4));
+    }
     return r;
 }
 
 Lhs AriParser::parse_lhs(sexpresso::Sexp &s) {
     Lhs lhs;
+    if (s.isString()) {
+        lhs.location = unescape(s.str());
+        return lhs;
+    }
+    if (s.childCount() == 0 || !s.getChild(0).isString()) {
+        throw std::invalid_argument("parsing failed: expected symbol");
+    }
     lhs.location = unescape(s.getChild(0).str());
     for (unsigned i = 1; i < s.childCount(); ++i) {
+        if (!s.getChild(i).isString()) {
+            throw std::invalid_argument("parsing failed: unexpected token");
+        }
         lhs.args.push_back(unescape(s.getChild(i).str()));
     }
     return lhs;
@@ -47,6 +154,13 @@ Lhs AriParser::parse_lhs(sexpresso::Sexp &s) {
 
 Rhs AriParser::parse_rhs(sexpresso::Sexp &s) {
     Rhs rhs;
+    if (s.isString()) {
+        rhs.location = unescape(s.str());
+        return rhs;
+    }
+    if (s.childCount() == 0 || !s.getChild(0).isString()) {
+        throw std::invalid_argument("parsing failed: expected symbol");
+    }
     rhs.location = unescape(s.getChild(0).str());
     for (unsigned i = 1; i < s.childCount(); ++i) {
         rhs.args.push_back(parse_expr(s.getChild(i)));
@@ -54,88 +168,345 @@ Rhs AriParser::parse_rhs(sexpresso::Sexp &s) {
     return rhs;
 }
 
+// Like read_formula and read_expr, the following functions use explicit stacks, so that the nesting depth is not limited
+// by the stack.
+
 Formula AriParser::parse_formula(sexpresso::Sexp &s) {
-    const auto fst {s.getChild(0).str()};
-    if (fst == "exists") {
-        Exists ex;
-        auto decls {s.getChild(1)};
-        for (unsigned i = 0; i < decls.childCount(); ++i) {
-            ex.vars.push_back(unescape(decls.getChild(i).getChild(0).str()));
-        }
-        ex.matrix = std::make_shared<Formula>(parse_formula(s.getChild(2)));
-        return ex;
-    } else if (fst == "and" || fst == "or") {
-        BoolOp op;
-        if (fst == "and") {
-            op = BoolOp::And;
-        } else if (fst == "or") {
-            op = BoolOp::Or;
+    // the applications whose arguments are not complete yet, with the position of their first argument in args and the
+    // range of the children that remain to be parsed, where quantifiers keep their variables in vars
+    struct Frame {
+        sexpresso::Sexp *app;
+        std::optional<BoolOp> op;
+        size_t first;
+        size_t first_var;
+        size_t next;
+        size_t end;
+    };
+    // the stacks are reused by all calls on this thread to avoid allocations
+    thread_local std::vector<Frame> todo;
+    thread_local std::vector<Formula> args;
+    thread_local std::vector<Symbol> vars;
+    todo.clear();
+    args.clear();
+    vars.clear();
+    auto cur {&s};
+    while (cur) {
+        if (cur->isString()) {
+            if (cur->str() == "true") {
+                args.push_back(True);
+            } else if (cur->str() == "false") {
+                args.push_back(False);
+            } else {
+                throw std::invalid_argument("unknown formula " + std::string{cur->str()});
+            }
+        } else if (cur->childCount() == 0 || !cur->getChild(0).isString()) {
+            throw std::invalid_argument("parsing failed: expected connective");
+        } else if (const auto fst {cur->getChild(0).str()}; const auto op {rel_op(fst)}) {
+            if (cur->childCount() != 3) {
+                throw std::invalid_argument("parsing failed: unexpected token");
+            }
+            auto lhs {parse_expr(cur->getChild(1))};
+            args.emplace_back(Rel{std::move(lhs), *op, parse_expr(cur->getChild(2))});
+        } else if (const auto op {bool_op(fst)}) {
+            todo.push_back({cur, op, args.size(), vars.size(), 1, cur->childCount()});
+        } else if (fst == "exists") {
+            if (cur->childCount() != 3 || !cur->getChild(1).isSexp()) {
+                throw std::invalid_argument("parsing failed: unexpected token");
+            }
+            const auto first_var {vars.size()};
+            auto &decls {cur->getChild(1)};
+            for (unsigned i = 0; i < decls.childCount(); ++i) {
+                auto &decl {decls.getChild(i)};
+                if (!decl.isSexp() || decl.childCount() == 0 || !decl.getChild(0).isString()) {
+                    throw std::invalid_argument("parsing failed: expected symbol");
+                }
+                vars.push_back(unescape(decl.getChild(0).str()));
+            }
+            todo.push_back({cur, std::nullopt, args.size(), first_var, 2, 3});
         } else {
-            throw std::invalid_argument("unknown Boolean connection");
+            throw std::invalid_argument("unknown relation");
         }
-        std::vector<Formula> args;
-        for (unsigned i = 1; i < s.childCount(); ++i) {
-            args.push_back(parse_formula(s.getChild(i)));
+        cur = nullptr;
+        while (!cur && !todo.empty()) {
+            auto &f {todo.back()};
+            if (f.next < f.end) {
+                cur = &f.app->getChild(f.next++);
+                continue;
+            }
+            const auto res {f.op
+                ? mk_bool_app(*f.op, std::span<const Formula>{args.data() + f.first, args.size() - f.first})
+                : mk_exists(std::span<const Symbol>{vars.data() + f.first_var, vars.size() - f.first_var}, args.back())};
+            args.erase(args.begin() + f.first, args.end());
+            vars.erase(vars.begin() + f.first_var, vars.end());
+            args.push_back(res);
+            todo.pop_back();
         }
-        return mk_bool_app(op, args);
-    } else {
-        RelOp op;
-        if (fst == "=") {
-            op = RelOp::Eq;
-        } else if (fst == "distinct") {
-            op = RelOp::Neq;
-        } else if (fst == ">=") {
-            op = RelOp::Geq;
-        } else if (fst == ">") {
-            op = RelOp::Gt;
-        } else if (fst == "<=") {
-            op = RelOp::Leq;
-        } else if (fst == "<") {
-            op = RelOp::Lt;
+    }
+    return args.back();
+}
+
+Expr AriParser::parse_expr(sexpresso::Sexp &s) {
+    // the applications whose arguments are not complete yet, with the position of their first argument in args and
+    // the index of the next child to parse
+    struct Frame {
+        sexpresso::Sexp *app;
+        ArithOp op;
+        size_t first;
+        size_t next;
+    };
+    thread_local std::vector<Frame> todo;
+    thread_local std::vector<Expr> args;
+    todo.clear();
+    args.clear();
+    auto cur {&s};
+    while (cur) {
+        if (cur->isString()) {
+            const auto str {cur->str()};
+            if (is_int(str)) {
+                args.emplace_back(parse_int(str));
+            } else {
+                args.emplace_back(Symbol(str));
+            }
         } else {
-            throw std::invalid_argument("unknown relation");
+            const auto op {cur->childCount() == 0 || !cur->getChild(0).isString() ? std::nullopt : arith_op(cur->getChild(0).str())};
+            if (!op) {
+                throw std::invalid_argument("unknown arithmetic operator");
+            }
+            todo.push_back({cur, *op, args.size(), 1});
+        }
+        cur = nullptr;
+        while (!cur && !todo.empty()) {
+            auto &f {todo.back()};
+            if (f.next < f.app->childCount()) {
+                cur = &f.app->getChild(f.next++);
+                continue;
+            }
+            const std::span<const Expr> app_args {args.data() + f.first, args.size() - f.first};
+            const auto res {mk_arith_app(f.op == ArithOp::Minus && app_args.size() == 1 ? ArithOp::UnaryMinus : f.op, app_args)};
+            args.erase(args.begin() + f.first, args.end());
+            args.push_back(res);
+            todo.pop_back();
         }
-        return Formula(Rel{parse_expr(s.getChild(1)), op, parse_expr(s.getChild(2))});
     }
+    return args.back();
 }
 
-Expr AriParser::parse_expr(sexpresso::Sexp &s) {
-    if (s.isString()) {
-        const auto str {s.str()};
-        if (is_int(str)) {
-            return Expr(stol(str));
+void AriParser::expect(sexpresso::Reader &reader, const sexpresso::EventKind kind) {
+    if (reader.next().kind != kind) {
+        throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "unexpected token" : reader.error()));
+    }
+}
+
+Symbol AriParser::read_symbol(sexpresso::Reader &reader) {
+    const auto ev {reader.next()};
+    if (ev.kind != sexpresso::EventKind::ATOM) {
+        throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "expected symbol" : reader.error()));
+    }
+    return unescape(ev.str());
+}
+
+ITS AriParser::read(sexpresso::Reader &reader) {
+    ITS its;
+    its.arena->preserve_shape = preserve_shape;
+    const ArenaScope scope(*its.arena);
+    while (true) {
+        const auto ev {reader.next()};
+        if (ev.kind == sexpresso::EventKind::END) {
+            break;
+        } else if (ev.kind == sexpresso::EventKind::ATOM) {
+            continue;
+        } else if (ev.kind != sexpresso::EventKind::OPEN) {
+            throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "unbalanced parentheses" : reader.error()));
+        }
+        const auto fst {reader.next()};
+        if (fst.kind == sexpresso::EventKind::ATOM && fst.str() == "rule") {
+            its.add_rule(read_rule(reader));
+        } else if (fst.kind == sexpresso::EventKind::ATOM && fst.str() == "entrypoint") {
+            its.init = read_symbol(reader);
+            reader.skipRest();
+        } else if (fst.kind == sexpresso::EventKind::OPEN) {
+            reader.skipRest();
+            reader.skipRest();
+        } else if (fst.kind != sexpresso::EventKind::CLOSE) {
+            reader.skipRest();
+        }
+    }
+    return its;
+}
+
+Rule AriParser::read_rule(sexpresso::Reader &reader) {
+    Rule r;
+    r.lhs = read_lhs(reader);
+    r.rhs = read_rhs(reader);
+    r.cond = True;
+    if (reader.peek().kind == sexpresso::EventKind::ATOM && reader.peek().str() == ":guard") {
+        reader.next();
+        r.cond = read_formula(reader);
+    }
+    reader.skipRest();
+    return r;
+}
+
+Lhs AriParser::read_lhs(sexpresso::Reader &reader) {
+    Lhs lhs;
+    if (reader.peek().kind == sexpresso::EventKind::ATOM) {
+        lhs.location = read_symbol(reader);
+        return lhs;
+    }
+    expect(reader, sexpresso::EventKind::OPEN);
+    lhs.location = read_symbol(reader);
+    while (reader.peek().kind == sexpresso::EventKind::ATOM) {
+        lhs.args.push_back(read_symbol(reader));
+    }
+    expect(reader, sexpresso::EventKind::CLOSE);
+    return lhs;
+}
+
+Rhs AriParser::read_rhs(sexpresso::Reader &reader) {
+    Rhs rhs;
+    if (reader.peek().kind == sexpresso::EventKind::ATOM) {
+        rhs.location = read_symbol(reader);
+        return rhs;
+    }
+    expect(reader, sexpresso::EventKind::OPEN);
+    rhs.location = read_symbol(reader);
+    while (reader.peek().kind != sexpresso::EventKind::CLOSE) {
+        rhs.args.push_back(read_expr(reader));
+    }
+    reader.next();
+    return rhs;
+}
+
+Formula AriParser::read_formula(sexpresso::Reader &reader) {
+    // the connectives and quantifiers whose arguments are not complete yet, with the position of their first argument
+    // in args resp. of their first variable in vars, so that the nesting depth is not limited by the stack
+    struct Frame {
+        std::optional<BoolOp> op;
+        size_t first;
+        size_t first_var;
+    };
+    std::vector<Frame> todo;
+    std::vector<Formula> args;
+    std::vector<Symbol> vars;
+    do {
+        const auto ev {reader.next()};
+        if (ev.kind == sexpresso::EventKind::ATOM) {
+            if (ev.str() == "true") {
+                args.push_back(True);
+            } else if (ev.str() == "false") {
+                args.push_back(False);
+            } else {
+                throw std::invalid_argument("unknown formula " + std::string{ev.str()});
+            }
+        } else if (ev.kind != sexpresso::EventKind::OPEN) {
+            throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "expected formula" : reader.error()));
+        } else if (const auto fst {reader.next()}; fst.kind != sexpresso::EventKind::ATOM) {
+            throw std::invalid_argument("parsing failed: expected connective");
+        } else if (const auto op {rel_op(fst.str())}) {
+            auto lhs {read_expr(reader)};
+            auto rhs {read_expr(reader)};
+            expect(reader, sexpresso::EventKind::CLOSE);
+            args.emplace_back(Rel{std::move(lhs), *op, std::move(rhs)});
+        } else if (const auto op {bool_op(fst.str())}) {
+            todo.push_back({op, args.size(), vars.size()});
+        } else if (fst.str() == "exists") {
+            todo.push_back({std::nullopt, args.size(), vars.size()});
+            expect(reader, sexpresso::EventKind::OPEN);
+            while (reader.peek().kind == sexpresso::EventKind::OPEN) {
+                reader.next();
+                vars.push_back(read_symbol(reader));
+                reader.skipRest();
+            }
+            expect(reader, sexpresso::EventKind::CLOSE);
         } else {
-            return Expr(str);
-        }
-    }
-    const auto fst {s.getChild(0).str()};
-    ArithOp op;
-    if (fst == "+") {
-        op = ArithOp::Plus;
-    } else if (fst == "*") {
-        op = ArithOp::Times;
-    } else if (fst == "-") {
-        if (s.childCount() == 2) {
-            op = ArithOp::UnaryMinus;
+            throw std::invalid_argument("unknown relation");
+        }
+        // connectives are complete at their ')', quantifiers after their matrix
+        while (!todo.empty()) {
+            const auto &f {todo.back()};
+            Formula res;
+            if (f.op && reader.peek().kind == sexpresso::EventKind::CLOSE) {
+                reader.next();
+                res = mk_bool_app(*f.op, std::span<const Formula>{args.data() + f.first, args.size() - f.first});
+            } else if (!f.op && args.size() > f.first) {
+                res = mk_exists(std::span<const Symbol>{vars.data() + f.first_var, vars.size() - f.first_var}, args.back());
+                expect(reader, sexpresso::EventKind::CLOSE);
+            } else {
+                break;
+            }
+            args.erase(args.begin() + f.first, args.end());
+            vars.erase(vars.begin() + f.first_var, vars.end());
+            args.push_back(res);
+            todo.pop_back();
+        }
+    } while (!todo.empty());
+    return args.back();
+}
+
+Expr AriParser::read_expr(sexpresso::Reader &reader) {
+    // the applications whose arguments are not complete yet, with the position of their first argument in args, so
+    // that the nesting depth is not limited by the stack
+    std::vector<std::pair<ArithOp, size_t>> todo;
+    std::vector<Expr> args;
+    do {
+        const auto ev {reader.next()};
+        if (ev.kind == sexpresso::EventKind::ATOM) {
+            const auto str {ev.str()};
+            if (is_int(str)) {
+                args.emplace_back(parse_int(str));
+            } else {
+                args.emplace_back(Symbol(str));
+            }
+        } else if (ev.kind == sexpresso::EventKind::OPEN) {
+            const auto fst {reader.next()};
+            const auto op {arith_op(fst.str())};
+            if (fst.kind != sexpresso::EventKind::ATOM || !op) {
+                throw std::invalid_argument("unknown arithmetic operator");
+            }
+            todo.emplace_back(*op, args.size());
         } else {
-            op = ArithOp::Minus;
+            throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "expected expression" : reader.error()));
         }
-    } else {
-        throw std::invalid_argument("unknown arithmetic operator");
+        while (!todo.empty() && reader.peek().kind == sexpresso::EventKind::CLOSE) {
+            reader.next();
+            auto [op, first] {todo.back()};
+            todo.pop_back();
+            const std::span<const Expr> app_args {args.data() + first, args.size() - first};
+            if (op == ArithOp::Minus && app_args.size() == 1) {
+                op = ArithOp::UnaryMinus;
+            }
+            const auto res {mk_arith_app(op, app_args)};
+            args.erase(args.begin() + first, args.end());
+            args.push_back(res);
+        }
+    } while (!todo.empty());
+    return args.back();
+}
+
+ITS AriParser::parse_chunks(std::string_view input, const unsigned threads, ITS (AriParser::*parse)(sexpresso::Reader&)) {
+    const auto chunks {sexpresso::splitElements(input, parallel::chunks(input.size(), threads))};
+    if (chunks.back().data() + chunks.back().size() != input.data() + input.size()) {
+        throw std::invalid_argument("parsing failed: unbalanced parentheses");
     }
-    std::vector<Expr> args;
-    for (unsigned i = 1; i < s.childCount(); ++i) {
-        args.push_back(parse_expr(s.getChild(i)));
+    std::vector<ITS> results(chunks.size());
+    parallel::for_each_index(chunks.size(), [&](const size_t i) {
+        sexpresso::Reader reader(chunks[i]);
+        results[i] = (this->*parse)(reader);
+    });
+    ITS its {std::move(results.front())};
+    for (size_t i = 1; i < results.size(); ++i) {
+        // the last entrypoint wins, as if the chunks were parsed sequentially
+        if (results[i].init != Symbol()) {
+            its.init = std::move(results[i].init);
+        }
+        its.append(std::move(results[i]));
     }
-    return mk_arith_app(op, args);
+    return its;
 }
 
-ITS AriParser::loadFromFile(const std::string &filename) {
-    std::ifstream ifs(filename);
-    std::string content(
-        (std::istreambuf_iterator<char>(ifs)),
-        (std::istreambuf_iterator<char>()));
-    sexpresso::Sexp sexp = sexpresso::parse(content);
+ITS AriParser::loadFromFile(const std::string &filename, const bool generic, const unsigned threads, const bool preserve_shape) {
+    const MappedFile file(filename);
     AriParser parser;
-    return parser.parse(sexp);
+    parser.preserve_shape = preserve_shape;
+    return parser.parse_chunks(file.view(), threads, generic ? &AriParser::parse : &AriParser::read);
 }
@@ -5,15 +5,36 @@
 
 class AriParser {
 
-    ITS parse(sexpresso::Sexp &s);
+    // see Arena::preserve_shape, which is set for the arenas of all chunks
+    bool preserve_shape {false};
+
+    // generic path: materializes every top-level form as a sexpresso::Sexp before converting it
+    ITS parse(sexpresso::Reader &reader);
     Rule parse_rule(sexpresso::Sexp &s);
     Lhs parse_lhs(sexpresso::Sexp &s);
     Rhs parse_rhs(sexpresso::Sexp &s);
     Formula parse_formula(sexpresso::Sexp &s);
     Expr parse_expr(sexpresso::Sexp &s);
 
+    // fused path: builds the ITS directly from the tokens, without constructing any sexpresso::Sexp
+    ITS read(sexpresso::Reader &reader);
+    Rule read_rule(sexpresso::Reader &reader);
+    Lhs read_lhs(sexpresso::Reader &reader);
+    Rhs read_rhs(sexpresso::Reader &reader);
+    Formula read_formula(sexpresso::Reader &reader);
+    Expr read_expr(sexpresso::Reader &reader);
+    Symbol read_symbol(sexpresso::Reader &reader);
+    void expect(sexpresso::Reader &reader, const sexpresso::EventKind kind);
+
+    // splits the input at top-level forms, parses the chunks concurrently, and concatenates the results in order
+    ITS parse_chunks(std::string_view input, const unsigned threads, ITS (AriParser::*parse)(sexpresso::Reader&));
+
 public:
 
-    static ITS loadFromFile(const std::string &filename);
+    /**
+     * Uses the fused parser unless generic is true. Both accept the same inputs and yield the same ITS. Large files are
+     * parsed by up to threads threads. The resulting ITS preserves the shape of its input if preserve_shape is set.
+     */
+    static ITS loadFromFile(const std::string &filename, const bool generic = false, const unsigned threads = 1, const bool preserve_shape = false);
 
 };
\ No newline at end of file
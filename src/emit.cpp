@@ -0,0 +1,871 @@
+#include "emit.hpp"
+#include "traversal.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <bit>
+#include <stdexcept>
+
+// The functions in this file write the output formats directly into a sink, in time linear in the size of the output.
+// The s-expressions are the same as those of to_sexp, ITS::to_ari, and ITS::to_its, but they are not built.
+
+using namespace emit;
+
+namespace {
+
+    std::string pow_name(const unsigned i) {
+        return "pow" + std::to_string(i);
+    }
+
+    size_t pow_name_size(const unsigned i) {
+        return 3 + Number(i).size;
+    }
+
+    unsigned width(const long exponent) {
+        return std::bit_width(static_cast<unsigned long>(exponent));
+    }
+
+    // the size of the innermost expression of the encoding of powers via repeated squaring, see pow_to_sexp
+    unsigned long squares_product_size(const long exponent) {
+        const auto w {width(exponent)};
+        if (std::popcount(static_cast<unsigned long>(exponent)) == 1) {
+            return pow_name_size(w - 1);
+        }
+        unsigned long res {2 + 2};
+        for (unsigned i = 0; i < w; ++i) {
+            if (exponent >> i & 1) {
+                res += pow_name_size(i) + 1;
+            }
+        }
+        return res;
+    }
+
+    unsigned long square_size(const unsigned i) {
+        return list_size(1 + 2 * pow_name_size(i - 1), 3);
+    }
+
+    // the size of the lets that bind pow{from}, ..., pow{w-1} in the encoding via repeated squaring, where the size of
+    // the base only matters if from is 0
+    unsigned long squaring_size(const unsigned long base_size, const long exponent, const unsigned from) {
+        auto res {squares_product_size(exponent)};
+        for (auto i = width(exponent); i-- > from;) {
+            const auto binding {list_size(pow_name_size(i) + (i == 0 ? base_size : square_size(i)), 2)};
+            const auto bindings {list_size(binding, 1)};
+            res = list_size(3 + bindings + res, 3);
+        }
+        return res;
+    }
+
+    // whether pow_to_sexp encodes base^exponent via repeated squaring in the smt2 format, given the size of the base
+    bool use_squaring(const unsigned long base_size, const long exponent) {
+        return squaring_size(base_size, exponent, 0) < 3 + static_cast<double>(exponent) * (base_size + 1);
+    }
+
+    // the size of the base that suffices to decide use_squaring: if the base is larger than the rest of the encoding,
+    // then the encoding is smaller than two copies of the base
+    unsigned long squaring_cap(const long exponent) {
+        return squaring_size(0, exponent, 0) + 1;
+    }
+
+    // the size of (* base ... base), as a double to avoid overflows
+    double product_size(const unsigned long base_size, const long exponent) {
+        return 4 + static_cast<double>(exponent) * (base_size + 1);
+    }
+
+    // writes the remaining bindings and the product of the encoding of a power via repeated squaring, and closes the
+    // lets that bind pow1, ..., pow{w-1}
+    void write_squares(const long exponent, SexpWriter &out) {
+        const auto w {width(exponent)};
+        for (unsigned i = 1; i < w; ++i) {
+            out.open(squaring_size(0, exponent, i), 3);
+            out.atom("let");
+            out.open(list_size(list_size(pow_name_size(i) + square_size(i), 2), 1), 1, true);
+            out.open(list_size(pow_name_size(i) + square_size(i), 2), 2);
+            out.atom(pow_name(i));
+            out.open(square_size(i), 3);
+            out.atom("*");
+            out.atom(pow_name(i - 1));
+            out.atom(pow_name(i - 1));
+            out.close();
+            out.close();
+            out.close();
+        }
+        if (std::popcount(static_cast<unsigned long>(exponent)) == 1) {
+            out.atom(pow_name(w - 1));
+        } else {
+            out.open(squares_product_size(exponent), std::popcount(static_cast<unsigned long>(exponent)) + 1);
+            out.atom("*");
+            for (unsigned i = 0; i < w; ++i) {
+                if (exponent >> i & 1) {
+                    out.atom(pow_name(i));
+                }
+            }
+            out.close();
+        }
+        for (unsigned i = 1; i < w; ++i) {
+            out.close();
+        }
+    }
+
+}
+
+namespace emit {
+
+    size_t symbol_size(const Symbol x) {
+        const auto &name {x.name()};
+        return is_identifier(name) ? name.size() : name.size() + 2;
+    }
+
+    void write_symbol(const Symbol x, SexpWriter &out) {
+        const auto &name {x.name()};
+        if (is_identifier(name)) {
+            out.atom(name);
+        } else {
+            out.atom(escape(name));
+        }
+    }
+
+    const char* rel_op_name(const RelOp op) {
+        switch (op) {
+            case RelOp::Eq: return "=";
+            case RelOp::Geq: return ">=";
+            case RelOp::Gt: return ">";
+            case RelOp::Leq: return "<=";
+            case RelOp::Lt: return "<";
+            case RelOp::Neq: return "distinct";
+        }
+        throw std::invalid_argument("unknown relation");
+    }
+
+    const char* bool_op_name(const BoolOp op) {
+        switch (op) {
+            case BoolOp::And: return "and";
+            case BoolOp::Or: return "or";
+            case BoolOp::Not: return "not";
+        }
+        throw std::invalid_argument("unknown boolean operator");
+    }
+
+    unsigned long decls_size(std::span<const Symbol> vars) {
+        unsigned long res {0};
+        for (const auto &x: vars) {
+            res += list_size(x.name().size() + 3, 2);
+        }
+        return list_size(res, vars.size());
+    }
+
+    void open_exists(std::span<const Symbol> vars, const unsigned long size, SexpWriter &out) {
+        out.open(size, 3);
+        out.atom("exists");
+        out.open(decls_size(vars), vars.size(), true);
+        for (const auto &x: vars) {
+            out.open(list_size(x.name().size() + 3, 2), 2);
+            out.atom(x.name());
+            out.atom("Int");
+            out.close();
+        }
+        out.close();
+    }
+
+    unsigned long pow_base_cap(const long exponent, const SexpFormat format, const unsigned long cap) {
+        return format == SexpFormat::SMT2 ? std::max(cap, squaring_cap(exponent)) : cap;
+    }
+
+    unsigned long pow_size(const unsigned long base_size, const long exponent, const SexpFormat format, const unsigned long cap) {
+        assert(exponent > 1);
+        if (format == SexpFormat::SMT2 && use_squaring(base_size, exponent)) {
+            return std::min(squaring_size(base_size, exponent, 0), cap);
+        }
+        return std::min(product_size(base_size, exponent), static_cast<double>(cap));
+    }
+
+    long open_pow(const unsigned long base_size, const long exponent, const SexpFormat format, SexpWriter &out) {
+        if (exponent == 0) {
+            out.atom("1");
+            return 0;
+        } else if (exponent == 1) {
+            return 1;
+        } else if (format == SexpFormat::SMT2 && use_squaring(base_size, exponent)) {
+            // the outermost let binds pow0 to the base, the other ones are written by close_pow
+            out.open(squaring_size(base_size, exponent, 0), 3);
+            out.atom("let");
+            out.open(list_size(list_size(pow_name_size(0) + base_size, 2), 1), 1, true);
+            out.open(list_size(pow_name_size(0) + base_size, 2), 2);
+            out.atom("pow0");
+            return 1;
+        }
+        out.open(std::min(product_size(base_size, exponent), static_cast<double>(line_cap)), exponent + 1);
+        out.atom("*");
+        return exponent;
+    }
+
+    void close_pow(const long exponent, const long copies, SexpWriter &out) {
+        if (exponent <= 1) {
+            return;
+        } else if (copies == 1) {
+            // the binding of pow0 and the bindings of the outermost let
+            out.close();
+            out.close();
+            write_squares(exponent, out);
+        }
+        out.close();
+    }
+
+    void write_ari_declarations(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, SexpWriter &out) {
+        out.list({"format", "LCTRS"});
+        out.list({"theory", "Ints"});
+        for (const auto &[f,arity]: locations) {
+            const auto type_size {arity == 0 ? 3 : list_size(2 + 3 * (arity + 1), arity + 2)};
+            out.open(list_size(3 + symbol_size(f) + type_size, 3), 3);
+            out.atom("fun");
+            write_symbol(f, out);
+            if (arity == 0) {
+                out.atom("Int");
+            } else {
+                out.open(type_size, arity + 2);
+                out.atom("->");
+                for (unsigned i = 0; i <= arity; ++i) {
+                    out.atom("Int");
+                }
+                out.close();
+            }
+            out.close();
+        }
+        out.list({"entrypoint", init.name()});
+    }
+
+    unsigned long ari_lhs_size(const Lhs &lhs) {
+        auto res {symbol_size(lhs.location)};
+        for (const auto &x: lhs.args) {
+            res += symbol_size(x);
+        }
+        return list_size(res, lhs.args.size() + 1);
+    }
+
+    void write_ari_lhs(const Lhs &lhs, SexpWriter &out) {
+        out.open(ari_lhs_size(lhs), lhs.args.size() + 1);
+        write_symbol(lhs.location, out);
+        for (const auto &x: lhs.args) {
+            write_symbol(x, out);
+        }
+        out.close();
+    }
+
+    unsigned long its_transition_size(const Symbol from, const Symbol to, const unsigned long cond_size) {
+        return list_size(10 + 2 + from.name().size() + 3 + to.name().size() + cond_size, 6);
+    }
+
+    void open_its_transition(const Symbol from, const Symbol to, const unsigned long size, SexpWriter &out) {
+        out.open(size, 6);
+        out.atom("cfg_trans2");
+        out.atom("pc");
+        out.atom(from.name());
+        out.atom("pc1");
+        out.atom(to.name());
+    }
+
+    void open_its_system(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, std::span<const Symbol> pre_vars, std::span<const Symbol> post_vars, const size_t transitions, const unsigned long disj_size, SexpWriter &out) {
+        out.list({"declare-sort", "Loc", "0"});
+        unsigned long distinct_size {8};
+        for (const auto &[l,_]: locations) {
+            out.list({"declare-const", l.name(), "Loc"});
+            distinct_size += l.name().size();
+        }
+        distinct_size = list_size(distinct_size, locations.size() + 1);
+        out.open(list_size(6 + distinct_size, 2), 2);
+        out.atom("assert");
+        out.open(distinct_size, locations.size() + 1);
+        out.atom("distinct");
+        for (const auto &[l,_]: locations) {
+            out.atom(l.name());
+        }
+        out.close();
+        out.close();
+        out.write(sexpresso::parse("define-fun cfg_init ( (pc Loc) (src Loc) (rel Bool) ) Bool (and (= pc src) rel)"));
+        out.write(sexpresso::parse("define-fun cfg_trans2 ( (pc Loc) (src Loc) (pc1 Loc) (dst Loc) (rel Bool) ) Bool (and (= pc src) (= pc1 dst) rel)"));
+        out.write(sexpresso::parse("define-fun cfg_trans3 ( (pc Loc) (exit Loc) (pc1 Loc) (call Loc) (pc2 Loc) (return Loc) (rel Bool) ) Bool (and (= pc exit) (= pc1 call) (= pc2 return) rel)"));
+        // the declarations of the arguments of next_main extend those of init_main
+        const auto write_decls {[&](std::string_view pc, std::span<const Symbol> vars) {
+            out.list({pc, "Loc"});
+            for (const auto &x: vars) {
+                out.list({x.name(), "Int"});
+            }
+        }};
+        const auto decls_size {[&](std::string_view pc, std::span<const Symbol> vars) {
+            unsigned long res {list_size(pc.size() + 3, 2)};
+            for (const auto &x: vars) {
+                res += list_size(x.name().size() + 3, 2);
+            }
+            return res;
+        }};
+        const auto init_args_size {list_size(decls_size("pc", pre_vars), pre_vars.size() + 1)};
+        const auto init_def_size {list_size(8 + 2 + init.name().size() + 4, 4)};
+        out.open(list_size(10 + 9 + init_args_size + 4 + init_def_size, 5), 5);
+        out.atom("define-fun");
+        out.atom("init_main");
+        out.open(init_args_size, pre_vars.size() + 1, true);
+        write_decls("pc", pre_vars);
+        out.close();
+        out.atom("Bool");
+        out.list({"cfg_init", "pc", init.name(), "true"});
+        out.close();
+        const auto next_args {pre_vars.size() + 1 + post_vars.size() + 1};
+        const auto next_args_size {list_size(decls_size("pc", pre_vars) + decls_size("pc1", post_vars), next_args)};
+        out.open(std::min(list_size(10 + 9 + next_args_size + 4 + disj_size, 5), line_cap), 5);
+        out.atom("define-fun");
+        out.atom("next_main");
+        out.open(next_args_size, next_args, true);
+        write_decls("pc", pre_vars);
+        write_decls("pc1", post_vars);
+        out.close();
+        out.atom("Bool");
+        out.open(disj_size, transitions + 1);
+        out.atom("or");
+    }
+
+}
+
+namespace {
+
+    // the size of to_sexp(e, format), up to cap
+    unsigned long expr_size(const Expr &e, const SexpFormat format, const unsigned long cap) {
+        // the powers whose bases are being measured, with the size and the cap outside of the base
+        struct Power {
+            unsigned long res;
+            unsigned long cap;
+            long exponent;
+        };
+        std::vector<Power> powers;
+        unsigned long res {0};
+        auto current_cap {cap};
+        // nullptr marks the end of the base of the innermost power
+        std::vector<const Expr*> todo {&e};
+        while (true) {
+            if (res >= current_cap) {
+                // the size of a power is at least the size of its base
+                return cap;
+            } else if (todo.empty()) {
+                return res;
+            }
+            const auto node_ptr {todo.back()};
+            todo.pop_back();
+            if (!node_ptr) {
+                const auto power {powers.back()};
+                powers.pop_back();
+                res = power.res + pow_size(res, power.exponent, format, power.cap - power.res);
+                current_cap = power.cap;
+                continue;
+            }
+            const auto &node {*node_ptr};
+            if (const auto n {std::get_if<long>(&node)}) {
+                res += Number(*n).size;
+            } else if (const auto x {std::get_if<Symbol>(&node)}) {
+                res += symbol_size(*x);
+            } else {
+                const auto app {std::get<ArithAppPtr>(node)};
+                if (app->op == ArithOp::Pow) {
+                    const auto &base {app->args.front()};
+                    const auto exponent {std::get<long>(app->args.back())};
+                    if (exponent == 0) {
+                        res += 1;
+                    } else if (exponent == 1) {
+                        todo.push_back(&base);
+                    } else {
+                        powers.push_back({res, current_cap, exponent});
+                        current_cap -= res;
+                        res = 0;
+                        todo.push_back(nullptr);
+                        todo.push_back(&base);
+                    }
+                } else {
+                    // the operator has size 1
+                    res += list_size(1, app->args.size() + 1);
+                    for (const auto &arg: app->args) {
+                        todo.push_back(&arg);
+                    }
+                }
+            }
+        }
+    }
+
+    // the size of to_sexp(f, format), up to cap
+    unsigned long formula_size(const Formula &f, const SexpFormat format, const unsigned long cap) {
+        unsigned long res {0};
+        std::vector<const Formula*> todo {&f};
+        while (!todo.empty() && res < cap) {
+            const auto &node {*todo.back()};
+            todo.pop_back();
+            if (const auto rel {std::get_if<Rel>(&node)}) {
+                res += list_size(std::char_traits<char>::length(rel_op_name(rel->op)), 3);
+                if (res < cap) {
+                    res += expr_size(rel->lhs, format, cap - res);
+                }
+                if (res < cap) {
+                    res += expr_size(rel->rhs, format, cap - res);
+                }
+            } else if (const auto app {std::get_if<BoolAppPtr>(&node)}) {
+                const auto args {(*app)->args};
+                if (args.empty()) {
+                    // true resp. false
+                    res += (*app)->op == BoolOp::And ? 4 : 5;
+                } else {
+                    res += list_size(std::char_traits<char>::length(bool_op_name((*app)->op)), args.size() + 1);
+                    for (const auto &arg: args) {
+                        todo.push_back(&arg);
+                    }
+                }
+            } else {
+                const auto &ex {std::get<Exists>(node)};
+                res += list_size(6 + decls_size(ex.vars), 3);
+                todo.push_back(ex.matrix);
+            }
+        }
+        return std::min(res, cap);
+    }
+
+    class Emitter {
+
+        struct Task {
+            enum class Kind {
+                // writes expr count times
+                Expr,
+                Formula,
+                Close,
+                // closes a power whose base has been written count times
+                ClosePow
+            } kind;
+            const void *node;
+            long count;
+            long exponent;
+        };
+
+        SexpWriter &out;
+        SexpFormat format;
+        std::vector<Task> todo;
+
+        // the size of a list for SexpWriter::open, which is irrelevant if the current list fits into a line
+        template <class T, class Size>
+        unsigned long size(const T &node, Size &&size) const {
+            return out.flat() ? 0 : size(node, format, line_cap);
+        }
+
+        void write_pow(const Expr &base, const long exponent) {
+            const auto base_size {exponent > 1 ? expr_size(base, format, pow_base_cap(exponent, format, line_cap)) : 0};
+            const auto copies {open_pow(base_size, exponent, format, out)};
+            todo.push_back({Task::Kind::ClosePow, nullptr, copies, exponent});
+            if (copies > 0) {
+                todo.push_back({Task::Kind::Expr, &base, copies, 0});
+            }
+        }
+
+        void write_expr(const Expr &e) {
+            if (const auto n {std::get_if<long>(&e)}) {
+                out.atom(Number(*n).view());
+            } else if (const auto x {std::get_if<Symbol>(&e)}) {
+                write_symbol(*x, out);
+            } else {
+                const auto app {std::get<ArithAppPtr>(e)};
+                char op;
+                switch (app->op) {
+                    case ArithOp::UnaryMinus:
+                    case ArithOp::Minus: op = '-';
+                    break;
+                    case ArithOp::Plus: op = '+';
+                    break;
+                    case ArithOp::Times: op = '*';
+                    break;
+                    case ArithOp::Pow:
+                        write_pow(app->args.front(), std::get<long>(app->args.back()));
+                        return;
+                }
+                out.open(size(e, expr_size), app->args.size() + 1);
+                out.atom({&op, 1});
+                todo.push_back({Task::Kind::Close, nullptr, 0, 0});
+                for (auto it = app->args.rbegin(); it != app->args.rend(); ++it) {
+                    todo.push_back({Task::Kind::Expr, &*it, 1, 0});
+                }
+            }
+        }
+
+        void write_formula(const Formula &f) {
+            if (const auto rel {std::get_if<Rel>(&f)}) {
+                out.open(size(f, formula_size), 3);
+                out.atom(rel_op_name(rel->op));
+                todo.push_back({Task::Kind::Close, nullptr, 0, 0});
+                todo.push_back({Task::Kind::Expr, &rel->rhs, 1, 0});
+                todo.push_back({Task::Kind::Expr, &rel->lhs, 1, 0});
+            } else if (const auto app {std::get_if<BoolAppPtr>(&f)}) {
+                const auto args {(*app)->args};
+                if (args.empty()) {
+                    out.atom((*app)->op == BoolOp::And ? "true" : "false");
+                    return;
+                }
+                out.open(size(f, formula_size), args.size() + 1);
+                out.atom(bool_op_name((*app)->op));
+                todo.push_back({Task::Kind::Close, nullptr, 0, 0});
+                for (auto it = args.rbegin(); it != args.rend(); ++it) {
+                    todo.push_back({Task::Kind::Formula, &*it, 1, 0});
+                }
+            } else {
+                const auto &ex {std::get<Exists>(f)};
+                open_exists(ex.vars, size(f, formula_size), out);
+                todo.push_back({Task::Kind::Close, nullptr, 0, 0});
+                todo.push_back({Task::Kind::Formula, ex.matrix, 1, 0});
+            }
+        }
+
+        void run() {
+            while (!todo.empty()) {
+                const auto task {todo.back()};
+                todo.pop_back();
+                switch (task.kind) {
+                    case Task::Kind::Expr:
+                        if (task.count > 1) {
+                            todo.push_back({Task::Kind::Expr, task.node, task.count - 1, 0});
+                        }
+                        write_expr(*static_cast<const Expr*>(task.node));
+                        break;
+                    case Task::Kind::Formula:
+                        write_formula(*static_cast<const Formula*>(task.node));
+                        break;
+                    case Task::Kind::Close:
+                        out.close();
+                        break;
+                    case Task::Kind::ClosePow:
+                        close_pow(task.exponent, task.count, out);
+                        break;
+                }
+            }
+        }
+
+    public:
+
+        Emitter(SexpWriter &out, const SexpFormat format): out(out), format(format) {}
+
+        void write(const Expr &e) {
+            todo.push_back({Task::Kind::Expr, &e, 1, 0});
+            run();
+        }
+
+        void write(const Formula &f) {
+            todo.push_back({Task::Kind::Formula, &f, 1, 0});
+            run();
+        }
+
+    };
+
+    unsigned long ari_rhs_size(const Rhs &rhs, const unsigned long cap) {
+        auto res {symbol_size(rhs.location)};
+        for (const auto &arg: rhs.args) {
+            if (res >= cap) {
+                break;
+            }
+            res += expr_size(arg, SexpFormat::Ari, cap);
+        }
+        return std::min(list_size(res, rhs.args.size() + 1), cap);
+    }
+
+}
+
+void write_sexp(const Expr &e, const SexpFormat format, SexpWriter &out) {
+    Emitter(out, format).write(e);
+}
+
+void write_sexp(const Formula &f, const SexpFormat format, SexpWriter &out) {
+    Emitter(out, format).write(f);
+}
+
+void ITS::write_ari(SexpWriter &out, const unsigned threads) const {
+    write_ari_declarations(init, locations(), out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, SexpWriter &out) {
+        Emitter emitter(out, SexpFormat::Ari);
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            const auto guarded {!is_true(r.cond)};
+            const auto lhs_size {ari_lhs_size(r.lhs)};
+            const auto rhs_size {ari_rhs_size(r.rhs, line_cap)};
+            auto children_size {4 + lhs_size + rhs_size};
+            if (guarded && children_size < line_cap) {
+                children_size += 6 + formula_size(r.cond, SexpFormat::Ari, line_cap);
+            }
+            out.open(std::min(list_size(children_size, guarded ? 5 : 3), line_cap), guarded ? 5 : 3);
+            out.atom("rule");
+            write_ari_lhs(r.lhs, out);
+            out.open(out.flat() ? 0 : rhs_size, r.rhs.args.size() + 1);
+            write_symbol(r.rhs.location, out);
+            for (const auto &arg: r.rhs.args) {
+                emitter.write(arg);
+            }
+            out.close();
+            if (guarded) {
+                out.atom(":guard");
+                emitter.write(r.cond);
+            }
+            out.close();
+        }
+    });
+}
+
+void ITS::write_its(SexpWriter &out, const unsigned threads) const {
+    std::vector<Symbol> post_vars;
+    for (const auto &x: rules.front().rhs.args) {
+        assert(std::holds_alternative<Symbol>(x));
+        post_vars.push_back(std::get<Symbol>(x));
+    }
+    const auto transition_size {[&](const Rule &r) {
+        return its_transition_size(r.lhs.location, r.rhs.location, formula_size(r.cond, SexpFormat::SMT2, line_cap));
+    }};
+    unsigned long disj_size {2};
+    for (const auto &r: rules) {
+        if (disj_size >= line_cap) {
+            break;
+        }
+        disj_size += transition_size(r) + 1;
+    }
+    disj_size = std::min(list_size(disj_size, 1), line_cap);
+    open_its_system(init, locations(), rules.front().lhs.args, post_vars, rules.size(), disj_size, out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, SexpWriter &out) {
+        Emitter emitter(out, SexpFormat::SMT2);
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            for (const auto &x: r.rhs.args) {
+                assert(std::holds_alternative<Symbol>(x));
+            }
+            open_its_transition(r.lhs.location, r.rhs.location, out.flat() ? 0 : std::min(transition_size(r), line_cap), out);
+            emitter.write(r.cond);
+            out.close();
+        }
+    });
+    out.close();
+    out.close();
+}
+
+
+namespace {
+
+    // the relation with the surrounding spaces
+    const char* koat_rel_op(const RelOp op) {
+        switch (op) {
+            case RelOp::Eq: return " = ";
+            case RelOp::Geq: return " >= ";
+            case RelOp::Gt: return " > ";
+            case RelOp::Leq: return " <= ";
+            case RelOp::Lt: return " < ";
+            case RelOp::Neq: return " != ";
+        }
+        throw std::invalid_argument("unknown relation");
+    }
+
+    // koat has no negation, which is checked before anything is written, so that the output is not left truncated
+    void check_koat(const Formula &f) {
+        traversal::for_each(f, [](const Formula &f) {
+            if (const auto app {std::get_if<BoolAppPtr>(&f)}; app && (*app)->op == BoolOp::Not) {
+                throw std::invalid_argument(".koat does not allow negation");
+            }
+            return true;
+        });
+    }
+
+    class KoatEmitter {
+
+        struct Task {
+            enum class Kind {
+                Expr, Formula, Text,
+                // writes ^exponent
+                Exponent
+            } kind;
+            const void *node;
+            long exponent;
+        };
+
+        Sink &out;
+        std::vector<Task> todo;
+
+        template <class T>
+        void push_args(std::span<const T> args, const Task::Kind kind, const char *separator) {
+            for (auto it = args.rbegin(); it != args.rend(); ++it) {
+                if (it != args.rbegin()) {
+                    todo.push_back({Task::Kind::Text, separator, 0});
+                }
+                todo.push_back({kind, &*it, 0});
+            }
+        }
+
+        void write_expr(const Expr &e) {
+            if (const auto n {std::get_if<long>(&e)}) {
+                out.write(Number(*n).view());
+                return;
+            } else if (const auto x {std::get_if<Symbol>(&e)}) {
+                out.write(x->name());
+                return;
+            }
+            const auto app {std::get<ArithAppPtr>(e)};
+            switch (app->op) {
+                case ArithOp::UnaryMinus: {
+                    assert(app->args.size() == 1);
+                    // otherwise, -(x^2) would be read as (-x)^2, and -(x + y) as -x + y
+                    const auto &arg {app->args.front()};
+                    if (std::holds_alternative<ArithAppPtr>(arg)) {
+                        out.write("-(");
+                        todo.push_back({Task::Kind::Text, ")", 0});
+                    } else {
+                        out.put('-');
+                    }
+                    todo.push_back({Task::Kind::Expr, &arg, 0});
+                    break;
+                }
+                case ArithOp::Minus:
+                    push_args(app->args, Task::Kind::Expr, " - ");
+                    break;
+                case ArithOp::Plus:
+                    push_args(app->args, Task::Kind::Expr, " + ");
+                    break;
+                case ArithOp::Times:
+                    push_args(app->args, Task::Kind::Expr, " * ");
+                    break;
+                case ArithOp::Pow: {
+                    const auto &base {app->args.front()};
+                    const auto compound {std::holds_alternative<ArithAppPtr>(base)};
+                    if (compound) {
+                        out.put('(');
+                    }
+                    todo.push_back({Task::Kind::Exponent, nullptr, std::get<long>(app->args.back())});
+                    if (compound) {
+                        todo.push_back({Task::Kind::Text, ")", 0});
+                    }
+                    todo.push_back({Task::Kind::Expr, &base, 0});
+                    break;
+                }
+            }
+        }
+
+        void write_formula(const Formula &f) {
+            if (const auto rel {std::get_if<Rel>(&f)}) {
+                todo.push_back({Task::Kind::Expr, &rel->rhs, 0});
+                todo.push_back({Task::Kind::Text, koat_rel_op(rel->op), 0});
+                todo.push_back({Task::Kind::Expr, &rel->lhs, 0});
+            } else if (const auto app {std::get_if<BoolAppPtr>(&f)}) {
+                switch ((*app)->op) {
+                    case BoolOp::And:
+                        push_args((*app)->args, Task::Kind::Formula, " && ");
+                        break;
+                    case BoolOp::Or:
+                        push_args((*app)->args, Task::Kind::Formula, " || ");
+                        break;
+                    case BoolOp::Not: throw std::invalid_argument(".koat does not allow negation");
+                }
+            } else {
+                todo.push_back({Task::Kind::Formula, std::get<Exists>(f).matrix, 0});
+            }
+        }
+
+        void run() {
+            while (!todo.empty()) {
+                const auto task {todo.back()};
+                todo.pop_back();
+                switch (task.kind) {
+                    case Task::Kind::Expr:
+                        write_expr(*static_cast<const Expr*>(task.node));
+                        break;
+                    case Task::Kind::Formula:
+                        write_formula(*static_cast<const Formula*>(task.node));
+                        break;
+                    case Task::Kind::Text:
+                        out.write(static_cast<const char*>(task.node));
+                        break;
+                    case Task::Kind::Exponent:
+                        out.put('^');
+                        out.write(Number(task.exponent).view());
+                        break;
+                }
+            }
+        }
+
+    public:
+
+        explicit KoatEmitter(Sink &out): out(out) {}
+
+        void write(const Expr &e) {
+            todo.push_back({Task::Kind::Expr, &e, 0});
+            run();
+        }
+
+        void write(const Formula &f) {
+            todo.push_back({Task::Kind::Formula, &f, 0});
+            run();
+        }
+
+    };
+
+}
+
+void write_koat(const Expr &e, Sink &out) {
+    KoatEmitter(out).write(e);
+}
+
+void write_koat(const Formula &f, Sink &out) {
+    check_koat(f);
+    KoatEmitter(out).write(f);
+}
+
+void write_koat_declarations(const Symbol init, const std::vector<Symbol> &vars, Sink &out) {
+    out.write("(GOAL COMPLEXITY)\n");
+    out.write("(STARTTERM (FUNCTIONSYMBOLS ");
+    out.write(init.name());
+    out.write("))\n");
+    out.write("(VAR");
+    for (const auto &v: vars) {
+        out.put(' ');
+        out.write(v.name());
+    }
+    out.write(")\n");
+    out.write("(RULES\n");
+}
+
+void write_koat_lhs(const Lhs &lhs, Sink &out) {
+    out.write("  ");
+    out.write(lhs.location.name());
+    // nullary locations are written without opening parenthesis
+    if (!lhs.args.empty()) {
+        out.put('(');
+    }
+    for (size_t i = 0; i < lhs.args.size(); ++i) {
+        if (i > 0) {
+            out.put(',');
+        }
+        out.write(lhs.args[i].name());
+    }
+    out.write(") -> ");
+}
+
+void ITS::check_koat() const {
+    for (const auto &r: rules) {
+        ::check_koat(r.cond);
+    }
+}
+
+void ITS::write_koat(Sink &out, const unsigned threads) const {
+    check_koat();
+    write_koat_declarations(init, vars(), out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, Sink &out) {
+        KoatEmitter emitter(out);
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            write_koat_lhs(r.lhs, out);
+            out.write(r.rhs.location.name());
+            if (!r.rhs.args.empty()) {
+                out.put('(');
+            }
+            for (size_t i = 0; i < r.rhs.args.size(); ++i) {
+                if (i > 0) {
+                    out.put(',');
+                }
+                emitter.write(r.rhs.args[i]);
+            }
+            out.put(')');
+            if (!is_true(r.cond)) {
+                out.write(" :|: ");
+                emitter.write(r.cond);
+            }
+            out.put('\n');
+        }
+    });
+    out.write(")\n");
+}
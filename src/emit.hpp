@@ -0,0 +1,81 @@
+#pragma once
+
+#include <charconv>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "its.hpp"
+#include "writer.hpp"
+
+/**
+ * Building blocks for writing the s-expressions of ITS::to_ari and ITS::to_its with a SexpWriter instead of building
+ * them, shared by ITS and FlatITS. The layout of a list only depends on whether its size exceeds
+ * SexpWriter::max_line_size, so sizes are computed up to a cap, which takes time linear in the cap instead of the size of
+ * the subterm.
+ */
+namespace emit {
+
+    constexpr unsigned long line_cap {SexpWriter::max_line_size + 1};
+
+    // the size of a list with the given children, where the size of the parentheses is 2 and each child is followed
+    // by a space, see sexpresso::Sexp::addChild
+    constexpr unsigned long list_size(const unsigned long children_size, const size_t children) {
+        return 2 + children_size + children;
+    }
+
+    struct Number {
+        char buffer[24];
+        size_t size;
+
+        explicit Number(const long n) {
+            size = std::to_chars(buffer, buffer + sizeof(buffer), n).ptr - buffer;
+        }
+
+        std::string_view view() const {
+            return {buffer, size};
+        }
+    };
+
+    size_t symbol_size(const Symbol x);
+    void write_symbol(const Symbol x, SexpWriter &out);
+    const char* rel_op_name(const RelOp op);
+    const char* bool_op_name(const BoolOp op);
+
+    // the size of the declarations of the variables of an existential quantifier, each of which is (x Int)
+    unsigned long decls_size(std::span<const Symbol> vars);
+    // opens an existential quantifier of the given size and writes its declarations, but not its matrix
+    void open_exists(std::span<const Symbol> vars, const unsigned long size, SexpWriter &out);
+
+    // the cap for the size of the base that suffices to decide how base^exponent is written (see open_pow) and to
+    // compute its size up to cap
+    unsigned long pow_base_cap(const long exponent, const SexpFormat format, const unsigned long cap);
+    /**
+     * the size of base^exponent for exponent > 1, up to cap, given the size of the base up to cap, which suffices as
+     * the size of a power is at least the size of its base
+     */
+    unsigned long pow_size(const unsigned long base_size, const long exponent, const SexpFormat format, const unsigned long cap);
+    /**
+     * Writes base^exponent like pow_to_sexp, given the size of the base up to pow_base_cap(exponent, format, line_cap),
+     * which is only needed if the exponent is larger than 1: open_pow writes everything before the first copy of the
+     * base and returns how many copies have to be written, and close_pow writes everything after the last one.
+     */
+    long open_pow(const unsigned long base_size, const long exponent, const SexpFormat format, SexpWriter &out);
+    void close_pow(const long exponent, const long copies, SexpWriter &out);
+
+    void write_ari_declarations(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, SexpWriter &out);
+    unsigned long ari_lhs_size(const Lhs &lhs);
+    void write_ari_lhs(const Lhs &lhs, SexpWriter &out);
+
+    // the size of the transition from -> to with a condition of the given size, see its_transition
+    unsigned long its_transition_size(const Symbol from, const Symbol to, const unsigned long cond_size);
+    // opens the transition from -> to, whose condition has to be written next
+    void open_its_transition(const Symbol from, const Symbol to, const unsigned long size, SexpWriter &out);
+    /**
+     * writes its_system up to the transitions, i.e., the disjuncts of next_main, which have to be written next and
+     * followed by two closing parentheses, where disj_size is the size of the disjunction of the transitions
+     */
+    void open_its_system(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, std::span<const Symbol> pre_vars, std::span<const Symbol> post_vars, const size_t transitions, const unsigned long disj_size, SexpWriter &out);
+
+}
@@ -0,0 +1,604 @@
+#include "flat.hpp"
+#include "emit.hpp"
+#include "traversal.hpp"
+#include <assert.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace emit;
+
+namespace {
+
+using Tag = FlatITS::Tag;
+using Op = FlatITS::Op;
+
+constexpr uint32_t tag_bits {3};
+constexpr uint32_t op_bits {4};
+constexpr long min_int {-(1l << 28)};
+constexpr long max_int {(1l << 28) - 1};
+constexpr uint32_t max_payload {(1u << 29) - 1};
+constexpr uint32_t max_arity {(1u << 25) - 1};
+
+uint32_t word(const Tag tag, const uint32_t payload) {
+    return payload << tag_bits | static_cast<uint32_t>(tag);
+}
+
+Tag tag(const uint32_t w) {
+    return static_cast<Tag>(w & ((1u << tag_bits) - 1));
+}
+
+uint32_t payload(const uint32_t w) {
+    return w >> tag_bits;
+}
+
+long int_value(const uint32_t w) {
+    return static_cast<int32_t>(w) >> tag_bits;
+}
+
+Op op(const uint32_t w) {
+    return static_cast<Op>(payload(w) & ((1u << op_bits) - 1));
+}
+
+uint32_t arity(const uint32_t w) {
+    return payload(w) >> op_bits;
+}
+
+uint32_t offset(const size_t size) {
+    if (size > UINT32_MAX) {
+        throw std::invalid_argument("the ITS is too large for the flat representation");
+    }
+    return size;
+}
+
+Op flatten(const ArithOp op) {
+    switch (op) {
+        case ArithOp::Plus: return Op::Plus;
+        case ArithOp::Minus: return Op::Minus;
+        case ArithOp::Times: return Op::Times;
+        case ArithOp::UnaryMinus: return Op::UnaryMinus;
+        case ArithOp::Pow: return Op::Pow;
+    }
+    throw std::invalid_argument("unknown arithmetic operator");
+}
+
+Op flatten(const BoolOp op) {
+    switch (op) {
+        case BoolOp::And: return Op::And;
+        case BoolOp::Or: return Op::Or;
+        case BoolOp::Not: return Op::Not;
+    }
+    throw std::invalid_argument("unknown boolean operator");
+}
+
+Op flatten(const RelOp op) {
+    switch (op) {
+        case RelOp::Eq: return Op::Eq;
+        case RelOp::Neq: return Op::Neq;
+        case RelOp::Lt: return Op::Lt;
+        case RelOp::Leq: return Op::Leq;
+        case RelOp::Gt: return Op::Gt;
+        case RelOp::Geq: return Op::Geq;
+    }
+    throw std::invalid_argument("unknown relation");
+}
+
+std::string_view sexp_name(const Op op) {
+    switch (op) {
+        case Op::Plus: return "+";
+        case Op::Minus:
+        case Op::UnaryMinus: return "-";
+        case Op::Times: return "*";
+        case Op::Pow: break;
+        case Op::And: return "and";
+        case Op::Or: return "or";
+        case Op::Not: return "not";
+        case Op::Eq: return "=";
+        case Op::Neq: return "distinct";
+        case Op::Lt: return "<";
+        case Op::Leq: return "<=";
+        case Op::Gt: return ">";
+        case Op::Geq: return ">=";
+    }
+    throw std::invalid_argument("unknown operator");
+}
+
+// the separator between the arguments in the koat format
+std::string_view koat_separator(const Op op) {
+    switch (op) {
+        case Op::Plus: return " + ";
+        case Op::Minus: return " - ";
+        case Op::Times: return " * ";
+        case Op::UnaryMinus: return "";
+        case Op::Pow: break;
+        case Op::And: return " && ";
+        case Op::Or: return " || ";
+        case Op::Not: throw std::invalid_argument(".koat does not allow negation");
+        case Op::Eq: return " = ";
+        case Op::Neq: return " != ";
+        case Op::Lt: return " < ";
+        case Op::Leq: return " <= ";
+        case Op::Gt: return " > ";
+        case Op::Geq: return " >= ";
+    }
+    throw std::invalid_argument("unknown operator");
+}
+
+}
+
+FlatITS::FlatITS(const ITS &its): init(its.init) {
+    rules.reserve(its.get_rules().size());
+    for (const auto &r: its.get_rules()) {
+        const auto rhs {offset(code.size())};
+        for (const auto &arg: r.rhs.args) {
+            add(arg);
+        }
+        const auto cond {offset(code.size())};
+        add(r.cond);
+        rules.push_back(Rule{r.lhs, r.rhs.location, rhs, offset(r.rhs.args.size()), cond, offset(code.size())});
+    }
+}
+
+void FlatITS::add_op(const Op op, const size_t arity) {
+    if (arity > max_arity) {
+        throw std::invalid_argument("arity too large for the flat representation");
+    }
+    code.push_back(word(Tag::Op, static_cast<uint32_t>(arity) << op_bits | static_cast<uint32_t>(op)));
+}
+
+void FlatITS::add_literal(const long value) {
+    if (min_int <= value && value <= max_int) {
+        code.push_back(word(Tag::Int, static_cast<uint32_t>(value)));
+    } else {
+        code.push_back(word(Tag::Long, offset(literals.size())));
+        literals.push_back(value);
+    }
+}
+
+void FlatITS::add(const Expr &e) {
+    std::vector<const Expr*> todo {&e};
+    while (!todo.empty()) {
+        const auto &node {*todo.back()};
+        todo.pop_back();
+        if (std::holds_alternative<long>(node)) {
+            add_literal(std::get<long>(node));
+        } else if (std::holds_alternative<Symbol>(node)) {
+            const auto index {std::get<Symbol>(node).index()};
+            if (index > max_payload) {
+                throw std::invalid_argument("too many symbols for the flat representation");
+            }
+            code.push_back(word(Tag::Var, index));
+        } else {
+            const auto app {std::get<ArithAppPtr>(node)};
+            add_op(flatten(app->op), app->args.size());
+            if (app->op == ArithOp::Pow) {
+                // the exponent comes first, so that it is known before the base is written
+                add_literal(std::get<long>(app->args.back()));
+                todo.push_back(&app->args.front());
+            } else {
+                for (auto it = app->args.rbegin(); it != app->args.rend(); ++it) {
+                    todo.push_back(&*it);
+                }
+            }
+        }
+    }
+}
+
+void FlatITS::add(const Formula &f) {
+    const auto first_quantifier {quantifiers.size()};
+    traversal::for_each(f, [&](const Formula &f) {
+        if (std::holds_alternative<Rel>(f)) {
+            const auto &rel {std::get<Rel>(f)};
+            add_op(flatten(rel.op), 2);
+            add(rel.lhs);
+            add(rel.rhs);
+        } else if (std::holds_alternative<BoolAppPtr>(f)) {
+            const auto app {std::get<BoolAppPtr>(f)};
+            add_op(flatten(app->op), app->args.size());
+        } else if (std::holds_alternative<Exists>(f)) {
+            const auto &ex {std::get<Exists>(f)};
+            const auto index {offset(quantifiers.size())};
+            if (index > max_payload) {
+                throw std::invalid_argument("too many quantifiers for the flat representation");
+            }
+            const auto vars_begin {offset(bound_vars.size())};
+            bound_vars.insert(bound_vars.end(), ex.vars.begin(), ex.vars.end());
+            // the size is the offset of the matrix until the matrix is complete
+            quantifiers.push_back(Quantifier{vars_begin, offset(bound_vars.size()), offset(code.size() + 1)});
+            code.push_back(word(Tag::Exists, index));
+        } else {
+            throw std::invalid_argument("unknown formula");
+        }
+        return true;
+    });
+    for (auto i = first_quantifier; i < quantifiers.size(); ++i) {
+        const auto matrix {quantifiers[i].size};
+        quantifiers[i].size = skip(matrix) - matrix;
+    }
+}
+
+uint32_t FlatITS::skip(uint32_t pos) const {
+    for (uint32_t missing = 1; missing > 0; --missing) {
+        const auto w {code[pos++]};
+        if (tag(w) == Tag::Op) {
+            missing += arity(w);
+        } else if (tag(w) == Tag::Exists) {
+            ++missing;
+        }
+    }
+    return pos;
+}
+
+std::vector<std::pair<Symbol, unsigned>> FlatITS::locations() const {
+    std::unordered_map<Symbol, unsigned> arities;
+    for (const auto &r: rules) {
+        arities.emplace(r.lhs.location, r.lhs.args.size());
+        arities.emplace(r.rhs_location, r.arity);
+    }
+    std::vector<std::pair<Symbol, unsigned>> res {arities.begin(), arities.end()};
+    std::sort(res.begin(), res.end(), [](const auto &x, const auto &y) {
+        return by_name(x.first, y.first);
+    });
+    return res;
+}
+
+void FlatITS::collect_vars(uint32_t begin, const uint32_t end, std::unordered_set<Symbol> &vars) const {
+    while (begin < end) {
+        const auto w {code[begin++]};
+        switch (tag(w)) {
+            case Tag::Var: vars.insert(Symbol::from_index(payload(w)));
+            break;
+            case Tag::Exists: begin += quantifiers[payload(w)].size;
+            break;
+            default: break;
+        }
+    }
+}
+
+std::vector<Symbol> FlatITS::vars() const {
+    std::unordered_set<Symbol> vars;
+    for (const auto &r: rules) {
+        vars.insert(r.lhs.args.begin(), r.lhs.args.end());
+    }
+    collect_vars(0, offset(code.size()), vars);
+    std::vector<Symbol> res {vars.begin(), vars.end()};
+    std::sort(res.begin(), res.end(), by_name);
+    return res;
+}
+
+long FlatITS::value(const uint32_t w) const {
+    return tag(w) == Tag::Int ? int_value(w) : literals[payload(w)];
+}
+
+bool FlatITS::is_true(const uint32_t pos) const {
+    return code[pos] == word(Tag::Op, static_cast<uint32_t>(Op::And));
+}
+
+unsigned long FlatITS::sexp_size(uint32_t pos, const SexpFormat format, const unsigned long cap) const {
+    // the powers whose bases are being measured, with the size, the cap, and the number of missing terms outside of the
+    // base
+    struct Power {
+        unsigned long res;
+        unsigned long cap;
+        long exponent;
+        uint32_t missing;
+    };
+    std::vector<Power> powers;
+    unsigned long res {0};
+    auto current_cap {cap};
+    // the number of missing terms of the current base resp. of the whole term
+    uint32_t missing {1};
+    while (true) {
+        if (res >= current_cap) {
+            // the size of a power is at least the size of its base
+            return cap;
+        } else if (missing == 0) {
+            if (powers.empty()) {
+                return res;
+            }
+            const auto power {powers.back()};
+            powers.pop_back();
+            res = power.res + pow_size(res, power.exponent, format, power.cap - power.res);
+            current_cap = power.cap;
+            missing = power.missing;
+            continue;
+        }
+        const auto w {code[pos++]};
+        --missing;
+        switch (tag(w)) {
+            case Tag::Int: res += Number(int_value(w)).size;
+            break;
+            case Tag::Long: res += Number(literals[payload(w)]).size;
+            break;
+            case Tag::Var: res += symbol_size(Symbol::from_index(payload(w)));
+            break;
+            case Tag::Exists: {
+                const auto &q {quantifiers[payload(w)]};
+                res += list_size(6 + decls_size(std::span(bound_vars).subspan(q.vars_begin, q.vars_end - q.vars_begin)), 3);
+                ++missing;
+                break;
+            }
+            case Tag::Op: {
+                if (op(w) == Op::Pow) {
+                    const auto exponent {value(code[pos++])};
+                    if (exponent == 0) {
+                        res += 1;
+                        pos = skip(pos);
+                    } else if (exponent == 1) {
+                        ++missing;
+                    } else {
+                        powers.push_back({res, current_cap, exponent, missing});
+                        current_cap -= res;
+                        res = 0;
+                        missing = 1;
+                    }
+                } else if (arity(w) == 0 && op(w) == Op::And) {
+                    res += 4;
+                } else if (arity(w) == 0 && op(w) == Op::Or) {
+                    res += 5;
+                } else {
+                    res += list_size(sexp_name(op(w)).size(), arity(w) + 1);
+                    missing += arity(w);
+                }
+                break;
+            }
+            default: throw std::invalid_argument("corrupt flat representation");
+        }
+    }
+}
+
+void FlatITS::write_sexp(uint32_t &pos, const SexpFormat format, SexpWriter &out) const {
+    // the lists and powers whose arguments are not yet complete
+    struct Frame {
+        // the number of missing arguments of a list, resp. of missing copies of the base of a power
+        long missing;
+        // 0 for lists
+        long exponent;
+        // the start of the base and the number of its copies
+        uint32_t base;
+        long copies;
+    };
+    std::vector<Frame> todo;
+    do {
+        const auto start {pos};
+        const auto w {code[pos++]};
+        const auto size {[&]() {
+            return out.flat() ? 0 : sexp_size(start, format, line_cap);
+        }};
+        switch (tag(w)) {
+            case Tag::Int: out.atom(Number(int_value(w)).view());
+            break;
+            case Tag::Long: out.atom(Number(literals[payload(w)]).view());
+            break;
+            case Tag::Var: write_symbol(Symbol::from_index(payload(w)), out);
+            break;
+            case Tag::Exists: {
+                const auto &q {quantifiers[payload(w)]};
+                open_exists(std::span(bound_vars).subspan(q.vars_begin, q.vars_end - q.vars_begin), size(), out);
+                todo.push_back(Frame{1, 0, 0, 0});
+                continue;
+            }
+            case Tag::Op: {
+                if (op(w) == Op::Pow) {
+                    const auto exponent {value(code[pos++])};
+                    const auto base_size {exponent > 1 ? sexp_size(pos, format, pow_base_cap(exponent, format, line_cap)) : 0};
+                    const auto copies {open_pow(base_size, exponent, format, out)};
+                    if (copies > 0) {
+                        todo.push_back(Frame{copies, exponent, pos, copies});
+                        continue;
+                    }
+                    pos = skip(pos);
+                } else if (arity(w) == 0 && op(w) == Op::And) {
+                    out.atom("true");
+                } else if (arity(w) == 0 && op(w) == Op::Or) {
+                    out.atom("false");
+                } else {
+                    out.open(size(), arity(w) + 1);
+                    out.atom(sexp_name(op(w)));
+                    if (arity(w) > 0) {
+                        todo.push_back(Frame{arity(w), 0, 0, 0});
+                        continue;
+                    }
+                    out.close();
+                }
+                break;
+            }
+            default: throw std::invalid_argument("corrupt flat representation");
+        }
+        // a term is complete, which may complete the enclosing lists and powers
+        while (!todo.empty()) {
+            auto &frame {todo.back()};
+            if (--frame.missing > 0) {
+                if (frame.exponent > 0) {
+                    // the next copy of the base
+                    pos = frame.base;
+                }
+                break;
+            }
+            if (frame.exponent > 0) {
+                close_pow(frame.exponent, frame.copies, out);
+            } else {
+                out.close();
+            }
+            todo.pop_back();
+        }
+    } while (!todo.empty());
+}
+
+/*
+ * Like ::write_koat, this function ignores precedences.
+ */
+void FlatITS::write_koat(uint32_t &pos, Sink &out) const {
+    struct Frame {
+        std::string_view separator;
+        // written after the last argument
+        std::string closing;
+        uint32_t missing;
+        bool first;
+    };
+    std::vector<Frame> todo;
+    do {
+        if (!todo.empty()) {
+            auto &frame {todo.back()};
+            if (!frame.first) {
+                out.write(frame.separator);
+            }
+            frame.first = false;
+            --frame.missing;
+        }
+        const auto w {code[pos++]};
+        switch (tag(w)) {
+            case Tag::Int: out.write(std::to_string(int_value(w)));
+            break;
+            case Tag::Long: out.write(std::to_string(literals[payload(w)]));
+            break;
+            case Tag::Var: out.write(Symbol::from_index(payload(w)).name());
+            break;
+            case Tag::Exists: todo.push_back(Frame{"", "", 1, true});
+            continue;
+            case Tag::Op: {
+                if (op(w) == Op::Pow) {
+                    const auto exponent {value(code[pos++])};
+                    // like ::write_koat, compound bases are parenthesized
+                    std::string closing {"^" + std::to_string(exponent)};
+                    if (tag(code[pos]) == Tag::Op) {
+                        out.put('(');
+                        closing.insert(0, ")");
+                    }
+                    todo.push_back(Frame{"", std::move(closing), 1, true});
+                    continue;
+                }
+                if (op(w) == Op::UnaryMinus) {
+                    assert(arity(w) == 1);
+                    // like ::write_koat, compound arguments are parenthesized
+                    if (tag(code[pos]) == Tag::Op) {
+                        out.write("-(");
+                        todo.push_back(Frame{"", ")", 1, true});
+                        continue;
+                    }
+                    out.put('-');
+                }
+                const auto separator {koat_separator(op(w))};
+                if (arity(w) > 0) {
+                    todo.push_back(Frame{separator, "", arity(w), true});
+                    continue;
+                }
+                break;
+            }
+            default: throw std::invalid_argument("corrupt flat representation");
+        }
+        while (!todo.empty() && todo.back().missing == 0) {
+            out.write(todo.back().closing);
+            todo.pop_back();
+        }
+    } while (!todo.empty());
+}
+
+void FlatITS::write_ari(SexpWriter &out, const unsigned threads) const {
+    write_ari_declarations(init, locations(), out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, SexpWriter &out) {
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            const auto guarded {!is_true(r.cond)};
+            auto rhs_size {symbol_size(r.rhs_location)};
+            for (auto pos = r.rhs; pos < r.cond && rhs_size < line_cap; pos = skip(pos)) {
+                rhs_size += sexp_size(pos, SexpFormat::Ari, line_cap);
+            }
+            rhs_size = std::min(list_size(rhs_size, r.arity + 1), line_cap);
+            auto children_size {4 + ari_lhs_size(r.lhs) + rhs_size};
+            if (guarded && children_size < line_cap) {
+                children_size += 6 + sexp_size(r.cond, SexpFormat::Ari, line_cap);
+            }
+            out.open(std::min(list_size(children_size, guarded ? 5 : 3), line_cap), guarded ? 5 : 3);
+            out.atom("rule");
+            write_ari_lhs(r.lhs, out);
+            out.open(out.flat() ? 0 : rhs_size, r.arity + 1);
+            write_symbol(r.rhs_location, out);
+            auto pos {r.rhs};
+            for (uint32_t i = 0; i < r.arity; ++i) {
+                write_sexp(pos, SexpFormat::Ari, out);
+            }
+            out.close();
+            if (guarded) {
+                out.atom(":guard");
+                pos = r.cond;
+                write_sexp(pos, SexpFormat::Ari, out);
+            }
+            out.close();
+        }
+    });
+}
+
+void FlatITS::write_its(SexpWriter &out, const unsigned threads) const {
+    for (const auto &r: rules) {
+        for (auto pos = r.rhs; pos < r.cond; ++pos) {
+            assert(tag(code[pos]) == Tag::Var);
+        }
+    }
+    const auto &first {rules.front()};
+    std::vector<Symbol> post_vars;
+    for (auto pos = first.rhs; pos < first.cond; ++pos) {
+        post_vars.push_back(Symbol::from_index(payload(code[pos])));
+    }
+    const auto transition_size {[&](const Rule &r) {
+        return its_transition_size(r.lhs.location, r.rhs_location, sexp_size(r.cond, SexpFormat::SMT2, line_cap));
+    }};
+    unsigned long disj_size {2};
+    for (const auto &r: rules) {
+        if (disj_size >= line_cap) {
+            break;
+        }
+        disj_size += transition_size(r) + 1;
+    }
+    disj_size = std::min(list_size(disj_size, 1), line_cap);
+    open_its_system(init, locations(), first.lhs.args, post_vars, rules.size(), disj_size, out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, SexpWriter &out) {
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            open_its_transition(r.lhs.location, r.rhs_location, out.flat() ? 0 : std::min(transition_size(r), line_cap), out);
+            auto pos {r.cond};
+            write_sexp(pos, SexpFormat::SMT2, out);
+            out.close();
+        }
+    });
+    out.close();
+    out.close();
+}
+
+void FlatITS::check_koat() const {
+    for (const auto &r: rules) {
+        for (auto pos {r.cond}; pos < r.end; ++pos) {
+            if (tag(code[pos]) == Tag::Op && op(code[pos]) == Op::Not) {
+                throw std::invalid_argument(".koat does not allow negation");
+            }
+        }
+    }
+}
+
+void FlatITS::write_koat(Sink &out, const unsigned threads) const {
+    check_koat();
+    write_koat_declarations(init, vars(), out);
+    write_concurrently(out, rules.size(), threads, [&](const size_t from, const size_t to, Sink &out) {
+        for (const auto &r: std::span(rules).subspan(from, to - from)) {
+            write_koat_lhs(r.lhs, out);
+            out.write(r.rhs_location.name());
+            // like ITS::write_koat, which drops the opening parenthesis of nullary locations
+            if (r.arity > 0) {
+                out.put('(');
+            }
+            auto pos {r.rhs};
+            for (uint32_t i = 0; i < r.arity; ++i) {
+                if (i > 0) {
+                    out.put(',');
+                }
+                write_koat(pos, out);
+            }
+            out.put(')');
+            if (!is_true(r.cond)) {
+                out.write(" :|: ");
+                pos = r.cond;
+                write_koat(pos, out);
+            }
+            out.put('\n');
+        }
+    });
+    out.write(")\n");
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "its.hpp"
+
+/**
+ * A compact representation of an ITS: the right-hand sides and conditions of all rules are stored in pre-order in a
+ * single array of 32-bit words, so that traversals are linear scans. The lowest 3 bits of a word are its tag, the
+ * remaining 29 bits its payload:
+ *  - Op: an operator (bits 3-6) and its arity (bits 7-31), followed by its arguments, where Pow has its exponent as first
+ *    and its base as second argument
+ *  - Int: an integer in [-2^28, 2^28), stored inline
+ *  - Var: the index of a Symbol
+ *  - Long: an index into the literals that do not fit into the payload
+ *  - Exists: an index into the quantifiers, followed by the matrix
+ */
+class FlatITS {
+
+public:
+
+    enum class Tag: uint32_t {
+        Op, Int, Var, Long, Exists
+    };
+
+    enum class Op: uint32_t {
+        Plus, Minus, Times, UnaryMinus, Pow, And, Or, Not, Eq, Neq, Lt, Leq, Gt, Geq
+    };
+
+    struct Rule {
+        Lhs lhs;
+        Symbol rhs_location;
+        // the arguments of the right-hand side start at rhs, the condition at cond, and the rule ends before end
+        uint32_t rhs;
+        uint32_t arity;
+        uint32_t cond;
+        uint32_t end;
+    };
+
+    struct Quantifier {
+        // the bound variables are bound_vars[vars_begin, vars_end)
+        uint32_t vars_begin;
+        uint32_t vars_end;
+        // the number of words of the matrix
+        uint32_t size;
+    };
+
+    explicit FlatITS(const ITS &its);
+
+    // all locations with their arities, sorted by name
+    std::vector<std::pair<Symbol, unsigned>> locations() const;
+    // all variables, sorted by name
+    std::vector<Symbol> vars() const;
+    // like the corresponding functions of ITS
+    void check_koat() const;
+    void write_koat(Sink &out, const unsigned threads = 1) const;
+    void write_ari(SexpWriter &out, const unsigned threads = 1) const;
+    void write_its(SexpWriter &out, const unsigned threads = 1) const;
+
+private:
+
+    Symbol init;
+    std::vector<Rule> rules;
+    std::vector<uint32_t> code;
+    std::vector<long> literals;
+    std::vector<Quantifier> quantifiers;
+    std::vector<Symbol> bound_vars;
+
+    void add_literal(const long value);
+    void add(const Expr &e);
+    void add(const Formula &f);
+    void add_op(const Op op, const size_t arity);
+    // the end of the term that starts at code[pos]
+    uint32_t skip(uint32_t pos) const;
+
+    // collects the variables in code[begin, end), ignoring quantified subformulas
+    void collect_vars(uint32_t begin, const uint32_t end, std::unordered_set<Symbol> &vars) const;
+    // the value of an Int or Long word
+    long value(const uint32_t w) const;
+    // the size of the s-expression of the term that starts at code[pos], up to cap, see emit.hpp
+    unsigned long sexp_size(uint32_t pos, const SexpFormat format, const unsigned long cap) const;
+    // the following functions write the term that starts at code[pos] and advance pos to its end
+    void write_sexp(uint32_t &pos, const SexpFormat format, SexpWriter &out) const;
+    void write_koat(uint32_t &pos, Sink &out) const;
+    bool is_true(const uint32_t pos) const;
+
+};
@@ -1,9 +1,13 @@
 #include "its.hpp"
+#include "traversal.hpp"
 #include <assert.h>
 #include <iostream>
 #include <set>
+#include <unordered_map>
 #include <cctype>
 #include <algorithm>
+#include <bit>
+#include <cmath>
 
 std::set<char> ident_char {'~', '!', '@', '$', '%', '^', '&', '*', '_', '-', '+', '=', '<', '>', '.', '?', '/'};
 
@@ -25,104 +29,304 @@ std::string escape(const std::string &s) {
     }
 }
 
-Expr mk_arith_app(const ArithOp op, const std::vector<Expr> &args) {
-    return std::make_shared<ArithApp>(op, args);
+namespace {
+
+    size_t combine(const size_t seed, const size_t hash) {
+        return seed ^ (hash + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+    }
+
+    template <class T>
+    size_t hash_all(size_t seed, std::span<const T> xs) {
+        for (const auto &x: xs) {
+            seed = combine(seed, std::hash<T>{}(x));
+        }
+        return seed;
+    }
+
 }
 
-Expr mk_plus(const std::vector<Expr> &args) {
+bool operator==(const ArithApp &x, const ArithApp &y) {
+    return x.op == y.op && std::ranges::equal(x.args, y.args);
+}
+
+size_t std::hash<ArithApp>::operator()(const ArithApp &app) const {
+    return hash_all(static_cast<size_t>(app.op), app.args);
+}
+
+bool operator==(const BoolApp &x, const BoolApp &y) {
+    return x.op == y.op && std::ranges::equal(x.args, y.args);
+}
+
+size_t std::hash<BoolApp>::operator()(const BoolApp &app) const {
+    return hash_all(static_cast<size_t>(app.op), app.args);
+}
+
+bool operator==(const Exists &x, const Exists &y) {
+    return std::ranges::equal(x.vars, y.vars) && *x.matrix == *y.matrix;
+}
+
+size_t std::hash<Rel>::operator()(const Rel &rel) const {
+    return combine(combine(static_cast<size_t>(rel.op), std::hash<Expr>{}(rel.lhs)), std::hash<Expr>{}(rel.rhs));
+}
+
+size_t std::hash<Exists>::operator()(const Exists &ex) const {
+    return combine(hash_all(0, ex.vars), std::hash<Formula>{}(*ex.matrix));
+}
+
+namespace {
+
+    /**
+     * Splices the arguments of those elements of args that are applications of the same associative operator, as
+     * determined by nested, into flat. Returns args if there are none.
+     */
+    template <class T, class Nested>
+    std::span<const T> flatten(const std::span<const T> args, std::vector<T> &flat, const Nested &nested) {
+        if (Arena::current().preserve_shape || std::none_of(args.begin(), args.end(), nested)) {
+            return args;
+        }
+        for (const auto &arg: args) {
+            if (const auto app {nested(arg)}) {
+                flat.insert(flat.end(), app->args.begin(), app->args.end());
+            } else {
+                flat.push_back(arg);
+            }
+        }
+        return flat;
+    }
+
+}
+
+Expr mk_arith_app(const ArithOp op, std::span<const Expr> args) {
+    std::vector<Expr> flat;
+    if (op == ArithOp::Plus || op == ArithOp::Times) {
+        args = flatten(args, flat, [op](const Expr &arg) {
+            const auto app {std::get_if<ArithAppPtr>(&arg)};
+            return app && (*app)->op == op ? *app : nullptr;
+        });
+    }
+    auto &arena {Arena::current()};
+    return arena.unique(ArithApp{op, args}, [&](const ArithApp &app) {
+        return ArithApp{app.op, arena.copy(app.args)};
+    });
+}
+
+Expr mk_arith_app(const ArithOp op, const Expr &arg1, const Expr &arg2) {
+    const Expr args[] {arg1, arg2};
+    return mk_arith_app(op, args);
+}
+
+Expr mk_plus(std::span<const Expr> args) {
     return mk_arith_app(ArithOp::Plus, args);
 }
 
-Expr mk_times(const std::vector<Expr> &args) {
+Expr mk_times(std::span<const Expr> args) {
     return mk_arith_app(ArithOp::Times, args);
 }
 
-Expr mk_minus(const std::vector<Expr> &args) {
+Expr mk_minus(std::span<const Expr> args) {
     return mk_arith_app(ArithOp::Minus, args);
 }
 
 Expr mk_unary_minus(const Expr &arg) {
-    return mk_arith_app(ArithOp::UnaryMinus, {arg});
+    return mk_arith_app(ArithOp::UnaryMinus, {&arg, 1});
+}
+
+Expr mk_pow(const Expr &base, const long exponent) {
+    assert(exponent >= 0);
+    return mk_arith_app(ArithOp::Pow, base, exponent);
+}
+
+Formula mk_bool_app(const BoolOp op, std::span<const Formula> args) {
+    std::vector<Formula> flat;
+    if (op == BoolOp::And || op == BoolOp::Or) {
+        args = flatten(args, flat, [op](const Formula &arg) {
+            const auto app {std::get_if<BoolAppPtr>(&arg)};
+            return app && (*app)->op == op ? *app : nullptr;
+        });
+    }
+    if (args.empty() && op == BoolOp::And) {
+        return True;
+    } else if (args.empty() && op == BoolOp::Or) {
+        return False;
+    }
+    auto &arena {Arena::current()};
+    return arena.unique(BoolApp{op, args}, [&](const BoolApp &app) {
+        return BoolApp{app.op, arena.copy(app.args)};
+    });
 }
 
-Formula mk_bool_app(const BoolOp op, const std::vector<Formula> &args) {
-    return std::make_shared<BoolApp>(op, args);
+Formula mk_bool_app(const BoolOp op, const Formula &arg1, const Formula &arg2) {
+    const Formula args[] {arg1, arg2};
+    return mk_bool_app(op, args);
 }
 
-Formula mk_and(const std::vector<Formula> &args) {
+Formula mk_and(std::span<const Formula> args) {
     return mk_bool_app(BoolOp::And, args);
 }
 
-Formula mk_or(const std::vector<Formula> &args) {
+Formula mk_or(std::span<const Formula> args) {
     return mk_bool_app(BoolOp::Or, args);
 }
 
 Formula mk_not(const Formula &arg) {
-    return mk_bool_app(BoolOp::Not, {arg});
+    return mk_bool_app(BoolOp::Not, {&arg, 1});
 }
 
-Formula True {mk_and({})};
-Formula False {mk_or({})};
+Formula mk_exists(std::span<const Symbol> vars, const Formula &matrix) {
+    auto &arena {Arena::current()};
+    return Exists{arena.copy(vars), arena.make<Formula>(matrix)};
+}
 
-std::map<std::string, unsigned> ITS::locations() const {
-    std::map<std::string, unsigned> res;
-    for (const auto &r: rules) {
-        assert(!r.lhs.location.empty());
-        assert(!r.rhs.location.empty());
-        res.emplace(r.lhs.location, r.lhs.args.size());
-        res.emplace(r.rhs.location, r.rhs.args.size());
+namespace {
+
+    const BoolApp true_app {BoolOp::And, {}};
+    const BoolApp false_app {BoolOp::Or, {}};
+
+}
+
+const Formula True {&true_app};
+const Formula False {&false_app};
+
+const std::vector<Rule>& ITS::get_rules() const {
+    return rules;
+}
+
+void ITS::invalidate_views() {
+    views->locations.reset();
+    views->vars.reset();
+}
+
+void ITS::add_rule(Rule rule) {
+    assert(!rule.lhs.location.name().empty());
+    assert(!rule.rhs.location.name().empty());
+    arities.emplace(rule.lhs.location, rule.lhs.args.size());
+    arities.emplace(rule.rhs.location, rule.rhs.args.size());
+    variables.insert(rule.lhs.args.begin(), rule.lhs.args.end());
+    // shared subterms are traversed once, and the set is reused to avoid allocations
+    thread_local std::unordered_set<const void*> visited;
+    visited.clear();
+    for (const auto &arg: rule.rhs.args) {
+        collect_vars(arg, variables, visited);
     }
+    collect_vars(rule.cond, variables, visited);
+    rules.push_back(std::move(rule));
+    invalidate_views();
+}
+
+void ITS::append(ITS &&other) {
+    if (rules.empty()) {
+        rules = std::move(other.rules);
+    } else {
+        std::move(other.rules.begin(), other.rules.end(), std::back_inserter(rules));
+    }
+    // the arities of locations that have occurred before are kept
+    arities.insert(other.arities.begin(), other.arities.end());
+    variables.insert(other.variables.begin(), other.variables.end());
+    arena->adopt(*other.arena);
+    other.rules.clear();
+    other.arities.clear();
+    other.variables.clear();
+    other.invalidate_views();
+    invalidate_views();
+}
+
+std::vector<Rule> ITS::take_rules() {
+    arities.clear();
+    variables.clear();
+    invalidate_views();
+    auto res {std::move(rules)};
+    rules.clear();
     return res;
 }
 
-void collect_vars(const Formula &f, std::set<std::string> &vars) {
-    if (std::holds_alternative<Rel>(f)) {
-        const auto rel {std::get<Rel>(f)};
-        collect_vars(rel.lhs, vars);
-        collect_vars(rel.rhs, vars);
-    } else if (std::holds_alternative<BoolAppPtr>(f)) {
-        const auto app {std::get<BoolAppPtr>(f)};
-        for (const auto &arg: app->args) {
-            collect_vars(arg, vars);
-        }
+const std::vector<std::pair<Symbol, unsigned>>& ITS::locations() const {
+    const std::lock_guard lock(views->mutex);
+    if (!views->locations) {
+        std::vector<std::pair<Symbol, unsigned>> res {arities.begin(), arities.end()};
+        std::sort(res.begin(), res.end(), [](const auto &x, const auto &y) {
+            return by_name(x.first, y.first);
+        });
+        views->locations = std::move(res);
     }
+    return *views->locations;
 }
 
-void collect_vars(const Expr &f, std::set<std::string> &vars) {
-    if (std::holds_alternative<std::string>(f)) {
-        vars.insert(std::get<std::string>(f));
-    } else if (std::holds_alternative<ArithAppPtr>(f)) {
-        const auto app {std::get<ArithAppPtr>(f)};
-        for (const auto &arg: app->args) {
-            collect_vars(arg, vars);
+void collect_vars(const Formula &f, std::unordered_set<Symbol> &vars, std::unordered_set<const void*> &visited) {
+    traversal::for_each(f, [&](const Formula &f) {
+        if (const auto rel {std::get_if<Rel>(&f)}) {
+            collect_vars(rel->lhs, vars, visited);
+            collect_vars(rel->rhs, vars, visited);
+            return false;
+        } else if (const auto app {std::get_if<BoolAppPtr>(&f)}) {
+            return visited.insert(*app).second;
         }
-    }
+        // variables of quantified subformulas are not collected
+        return false;
+    });
 }
 
-std::set<std::string> ITS::vars() const {
-    std::set<std::string> res;
-    for (const auto &r: rules) {
-        res.insert(r.lhs.args.begin(), r.lhs.args.end());
-        for (const auto &arg: r.rhs.args) {
-            collect_vars(arg, res);
+void collect_vars(const Expr &f, std::unordered_set<Symbol> &vars, std::unordered_set<const void*> &visited) {
+    traversal::for_each(f, [&](const Expr &e) {
+        if (const auto x {std::get_if<Symbol>(&e)}) {
+            vars.insert(*x);
+        } else if (const auto app {std::get_if<ArithAppPtr>(&e)}) {
+            return visited.insert(*app).second;
         }
-        collect_vars(r.cond, res);
+        return false;
+    });
+}
+
+void collect_vars(const Formula &f, std::unordered_set<Symbol> &vars) {
+    std::unordered_set<const void*> visited;
+    collect_vars(f, vars, visited);
+}
+
+void collect_vars(const Expr &f, std::unordered_set<Symbol> &vars) {
+    std::unordered_set<const void*> visited;
+    collect_vars(f, vars, visited);
+}
+
+void quantify_free_vars(Rule &r) {
+    std::unordered_set<Symbol> bound_vars {r.lhs.args.begin(), r.lhs.args.end()};
+    for (const auto &arg: r.rhs.args) {
+        collect_vars(arg, bound_vars);
+    }
+    std::unordered_set<Symbol> cond_vars;
+    collect_vars(r.cond, cond_vars);
+    std::vector<Symbol> free_vars;
+    for (const auto &x: cond_vars) {
+        if (!bound_vars.contains(x)) {
+            free_vars.push_back(x);
+        }
+    }
+    if (!free_vars.empty()) {
+        std::sort(free_vars.begin(), free_vars.end(), by_name);
+        r.cond = mk_exists(free_vars, r.cond);
     }
-    return res;
 }
 
-sexpresso::Sexp ITS::to_its() const {
+const std::vector<Symbol>& ITS::vars() const {
+    const std::lock_guard lock(views->mutex);
+    if (!views->vars) {
+        std::vector<Symbol> res {variables.begin(), variables.end()};
+        std::sort(res.begin(), res.end(), by_name);
+        views->vars = std::move(res);
+    }
+    return *views->vars;
+}
+
+sexpresso::Sexp its_system(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, std::span<const Symbol> pre_vars, std::span<const Symbol> post_vars, sexpresso::Sexp disj) {
     sexpresso::Sexp res;
     res.addChild(sexpresso::parse("declare-sort Loc 0"));
     sexpresso::Sexp assert, distinct;
     distinct.addChild("distinct");
-    for (const auto &[l,_]: locations()) {
+    for (const auto &[l,_]: locations) {
         sexpresso::Sexp decl;
         decl.addChild("declare-const");
-        decl.addChild(l);
+        decl.addChild(l.name());
         decl.addChild("Loc");
         res.addChild(decl);
-        distinct.addChild(l);
+        distinct.addChild(l.name());
     }
     assert.addChild("assert");
     assert.addChild(distinct);
@@ -130,58 +334,70 @@ sexpresso::Sexp ITS::to_its() const {
     res.addChild(sexpresso::parse("define-fun cfg_init ( (pc Loc) (src Loc) (rel Bool) ) Bool (and (= pc src) rel)"));
     res.addChild(sexpresso::parse("define-fun cfg_trans2 ( (pc Loc) (src Loc) (pc1 Loc) (dst Loc) (rel Bool) ) Bool (and (= pc src) (= pc1 dst) rel)"));
     res.addChild(sexpresso::parse("define-fun cfg_trans3 ( (pc Loc) (exit Loc) (pc1 Loc) (call Loc) (pc2 Loc) (return Loc) (rel Bool) ) Bool (and (= pc exit) (= pc1 call) (= pc2 return) rel)"));
-    sexpresso::Sexp init, args, init_def;
-    init.addChild("define-fun");
-    init.addChild("init_main");
+    sexpresso::Sexp init_fun, args, init_def;
+    init_fun.addChild("define-fun");
+    init_fun.addChild("init_main");
     args.addChild(sexpresso::parse("pc Loc"));
-    for (const auto &x: rules.front().lhs.args) {
+    for (const auto &x: pre_vars) {
         sexpresso::Sexp decl;
-        decl.addChild(x);
+        decl.addChild(x.name());
         decl.addChild("Int");
         args.addChild(decl);
     }
-    init.addChild(args);
-    init.addChild("Bool");
+    init_fun.addChild(args);
+    init_fun.addChild("Bool");
     init_def.addChild("cfg_init");
     init_def.addChild("pc");
-    init_def.addChild(this->init);
+    init_def.addChild(init.name());
     init_def.addChild("true");
-    init.addChild(init_def);
-    res.addChild(init);
+    init_fun.addChild(init_def);
+    res.addChild(init_fun);
     sexpresso::Sexp next;
     next.addChild("define-fun");
     next.addChild("next_main");
     args.addChild(sexpresso::parse("pc1 Loc"));
-    for (const auto &x: rules.front().rhs.args) {
+    for (const auto &x: post_vars) {
         sexpresso::Sexp decl;
-        assert(std::holds_alternative<std::string>(x));
-        decl.addChild(std::get<std::string>(x));
+        decl.addChild(x.name());
         decl.addChild("Int");
         args.addChild(decl);
     }
     next.addChild(args);
     next.addChild("Bool");
+    next.addChild(disj);
+    res.addChild(next);
+    return res;
+}
+
+sexpresso::Sexp its_transition(const Symbol from, const Symbol to, sexpresso::Sexp cond) {
+    sexpresso::Sexp trans;
+    trans.addChild("cfg_trans2");
+    trans.addChild("pc");
+    trans.addChild(from.name());
+    trans.addChild("pc1");
+    trans.addChild(to.name());
+    trans.addChild(cond);
+    return trans;
+}
+
+sexpresso::Sexp ITS::to_its() const {
+    std::vector<Symbol> post_vars;
+    for (const auto &x: rules.front().rhs.args) {
+        assert(std::holds_alternative<Symbol>(x));
+        post_vars.push_back(std::get<Symbol>(x));
+    }
     sexpresso::Sexp disj;
     disj.addChild("or");
     for (const auto &r: rules) {
         for (const auto &x: r.rhs.args) {
-            assert(std::holds_alternative<std::string>(x));
+            assert(std::holds_alternative<Symbol>(x));
         }
-        sexpresso::Sexp trans;
-        trans.addChild("cfg_trans2");
-        trans.addChild("pc");
-        trans.addChild(r.lhs.location);
-        trans.addChild("pc1");
-        trans.addChild(r.rhs.location);
-        trans.addChild(to_sexp(r.cond));
-        disj.addChild(trans);
+        disj.addChild(its_transition(r.lhs.location, r.rhs.location, to_sexp(r.cond, SexpFormat::SMT2)));
     }
-    next.addChild(disj);
-    res.addChild(next);
-    return res;
+    return its_system(init, locations(), rules.front().lhs.args, post_vars, disj);
 }
 
-sexpresso::Sexp ITS::to_ari() const {
+sexpresso::Sexp ari_declarations(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations) {
     sexpresso::Sexp ari, format, theory, entrypoint;
     format.addChild("format");
     format.addChild("LCTRS");
@@ -189,8 +405,7 @@ sexpresso::Sexp ITS::to_ari() const {
     theory.addChild("theory");
     theory.addChild("Ints");
     ari.addChild(theory);
-    const auto locs {locations()};
-    for (const auto &[f,arity]: locs) {
+    for (const auto &[f,arity]: locations) {
         sexpresso::Sexp decl, type;
         if (arity == 0) {
             type = sexpresso::Sexp("Int");
@@ -201,25 +416,35 @@ sexpresso::Sexp ITS::to_ari() const {
             }
         }
         decl.addChild("fun");
-        decl.addChild(escape(f));
+        decl.addChild(escape(f.name()));
         decl.addChild(type);
         ari.addChild(decl);
     }
     entrypoint.addChild("entrypoint");
-    entrypoint.addChild(init);
+    entrypoint.addChild(init.name());
     ari.addChild(entrypoint);
+    return ari;
+}
+
+sexpresso::Sexp ari_lhs(const Lhs &l) {
+    sexpresso::Sexp lhs;
+    lhs.addChild(escape(l.location.name()));
+    for (const auto &arg: l.args) {
+        lhs.addChild(escape(arg.name()));
+    }
+    return lhs;
+}
+
+sexpresso::Sexp ITS::to_ari() const {
+    auto ari {ari_declarations(init, locations())};
     for (const auto &r: rules) {
-        sexpresso::Sexp rule, lhs, rhs;
-        lhs.addChild(escape(r.lhs.location));
-        for (const auto &arg: r.lhs.args) {
-            lhs.addChild(escape(arg));
-        }
-        rhs.addChild(escape(r.rhs.location));
+        sexpresso::Sexp rule, rhs;
+        rhs.addChild(escape(r.rhs.location.name()));
         for (const auto &arg: r.rhs.args) {
             rhs.addChild(to_sexp(arg));
         }
         rule.addChild("rule");
-        rule.addChild(lhs);
+        rule.addChild(ari_lhs(r.lhs));
         rule.addChild(rhs);
         if (!is_true(r.cond)) {
             rule.addChild(":guard");
@@ -230,56 +455,74 @@ sexpresso::Sexp ITS::to_ari() const {
     return ari;
 }
 
-std::string ITS::to_koat() const {
-    std::vector<std::string> lines;
-    lines.push_back("(GOAL COMPLEXITY)");
-    lines.push_back("(STARTTERM (FUNCTIONSYMBOLS " + init + "))");
-    const auto vs {vars()};
-    std::string decl {"(VAR"};
-    for (const auto &v: vs) {
-        decl += " " + v;
+sexpresso::Sexp pow_to_sexp(const sexpresso::Sexp &base, const long exponent, const SexpFormat format) {
+    if (exponent == 0) {
+        return sexpresso::Sexp("1");
+    } else if (exponent == 1) {
+        return base;
     }
-    decl += ")";
-    lines.push_back(decl);
-    lines.push_back("(RULES");
-    for (const auto &r: rules) {
-        std::string s {"  "};
-        s += r.lhs.location;
-        s += "(";
-        for (const auto &arg: r.lhs.args) {
-            s += arg + ",";
+    if (format == SexpFormat::SMT2) {
+        // binds pow0 = base and pow{i+1} = pow{i} * pow{i}, so pow{i} = base^(2^i), and multiplies those where the
+        // corresponding bit of the exponent is set; as base is bound as well, the names cannot capture variables
+        const auto name {[](const unsigned i) {
+            return "pow" + std::to_string(i);
+        }};
+        const auto width {static_cast<unsigned>(std::bit_width(static_cast<unsigned long>(exponent)))};
+        sexpresso::Sexp res;
+        if (std::popcount(static_cast<unsigned long>(exponent)) == 1) {
+            res = sexpresso::Sexp(name(width - 1));
+        } else {
+            res.addChild("*");
+            for (unsigned i = 0; i < width; ++i) {
+                if (exponent >> i & 1) {
+                    res.addChild(name(i));
+                }
+            }
         }
-        s = s.substr(0, s.length() - 1);
-        s += ") -> ";
-        s += r.rhs.location;
-        s += "(";
-        for (const auto &arg: r.rhs.args) {
-            s += ::to_koat(arg) + ",";
+        for (auto i = width; i-- > 0;) {
+            sexpresso::Sexp let, bindings, binding;
+            binding.addChild(name(i));
+            if (i == 0) {
+                binding.addChild(base);
+            } else {
+                sexpresso::Sexp square;
+                square.addChild("*");
+                square.addChild(name(i - 1));
+                square.addChild(name(i - 1));
+                binding.addChild(square);
+            }
+            bindings.addChild(binding);
+            let.addChild("let");
+            let.addChild(bindings);
+            let.addChild(res);
+            res = std::move(let);
         }
-        s = s.substr(0, s.length() - 1);
-        s += ")";
-        if (!is_true(r.cond)) {
-            s += " :|: ";
-            s += ::to_koat(r.cond);
+        // the size of (* base ... base), see sexpresso::Sexp::width, as a double to avoid overflows
+        const auto unrolled_size {3 + static_cast<double>(exponent) * (base.width() + 1)};
+        // a cap of at least unrolled_size does not change the result of the comparison
+        const auto cap {static_cast<size_t>(std::min(std::ceil(unrolled_size), 1e18))};
+        if (res.width(cap) < unrolled_size) {
+            return res;
         }
-        lines.push_back(s);
     }
-    lines.push_back(")");
-    std::string res;
-    for (const auto &s: lines) {
-        res += s + '\n';
+    // the ari format supports neither powers nor local definitions
+    sexpresso::Sexp res;
+    res.addChild("*");
+    for (long i = 0; i < exponent; ++i) {
+        res.addChild(base);
     }
     return res;
 }
 
-sexpresso::Sexp to_sexp(const Expr &f) {
-    if (std::holds_alternative<long>(f)) {
-        return sexpresso::Sexp(std::to_string(std::get<long>(f)));
-    } else if (std::holds_alternative<std::string>(f)) {
-        return sexpresso::Sexp(escape(std::get<std::string>(f)));
-    } else {
+sexpresso::Sexp to_sexp(const Expr &f, const SexpFormat format) {
+    return traversal::fold<sexpresso::Sexp>(f, [&](const Expr &e, std::span<sexpresso::Sexp> args) {
+        if (std::holds_alternative<long>(e)) {
+            return sexpresso::Sexp(std::to_string(std::get<long>(e)));
+        } else if (std::holds_alternative<Symbol>(e)) {
+            return sexpresso::Sexp(escape(std::get<Symbol>(e).name()));
+        }
         sexpresso::Sexp res;
-        const auto app {std::get<ArithAppPtr>(f)};
+        const auto app {std::get<ArithAppPtr>(e)};
         switch (app->op) {
             case ArithOp::UnaryMinus:
             case ArithOp::Minus: res.addChild("-");
@@ -288,155 +531,97 @@ sexpresso::Sexp to_sexp(const Expr &f) {
             break;
             case ArithOp::Times: res.addChild("*");
             break;
+            case ArithOp::Pow: return pow_to_sexp(args.front(), std::get<long>(app->args.back()), format);
         }
-        for (const auto &arg: app->args) {
-            res.addChild(to_sexp(arg));
-        }
-        return res;
-    }
-}
-
-/*
- * This function ignores precedences, which is fine for the examples from the TPDB f8460262, as there are no parantheses, but of course incorrect in general!
- */
-std::string to_koat(const Expr &f) {
-    if (std::holds_alternative<long>(f)) {
-        return std::to_string(std::get<long>(f));
-    } else if (std::holds_alternative<std::string>(f)) {
-        return std::get<std::string>(f);
-    } else {
-        std::string res;
-        char op;
-        const auto app {std::get<ArithAppPtr>(f)};
-        switch (app->op) {
-            case ArithOp::UnaryMinus:
-            assert(app->args.size() == 1);
-            return "-" + ::to_koat(app->args.front());
-            break;
-            case ArithOp::Minus: op = '-';
-            break;
-            case ArithOp::Plus: op = '+';
-            break;
-            case ArithOp::Times: op = '*';
-            break;
-            default: throw std::invalid_argument("unknown arithmetic operator");
-        }
-        for (const auto &arg: app->args) {
-            res += ::to_koat(arg) + ' ' + op + ' ';
+        for (auto &arg: args) {
+            res.addChild(std::move(arg));
         }
-        res = res.substr(0, res.length() - 3);
         return res;
-    }
+    });
 }
 
 bool is_true(const Formula &f) {
     if (std::holds_alternative<BoolAppPtr>(f)) {
-        const auto app {std::get<BoolAppPtr>(f)};
+        const auto &app {std::get<BoolAppPtr>(f)};
         return app->op == BoolOp::And && app->args.empty();
     }
     return false;
 }
 
-sexpresso::Sexp to_sexp(const Formula &f) {
-    sexpresso::Sexp res;
-    if (std::holds_alternative<Rel>(f)) {
-        const auto rel {std::get<Rel>(f)};
-        switch (rel.op) {
-            case RelOp::Eq: res.addChild("=");
-            break;
-            case RelOp::Geq: res.addChild(">=");
-            break;
-            case RelOp::Gt: res.addChild(">");
-            break;
-            case RelOp::Leq: res.addChild("<=");
-            break;
-            case RelOp::Lt: res.addChild("<");
-            break;
-            case RelOp::Neq: res.addChild("distinct");
-            break;
-        }
-        res.addChild(to_sexp(rel.lhs));
-        res.addChild(to_sexp(rel.rhs));
-    } else if (std::holds_alternative<BoolAppPtr>(f)) {
-        const auto app {std::get<BoolAppPtr>(f)};
-        switch (app->op) {
-            case BoolOp::And:
-                if (app->args.empty()) {
-                    return sexpresso::Sexp("true");
-                }
-                res.addChild("and");
+sexpresso::Sexp to_sexp(const Formula &f, const SexpFormat format) {
+    return traversal::fold<sexpresso::Sexp>(f, [&](const Formula &f, std::span<sexpresso::Sexp> args) {
+        sexpresso::Sexp res;
+        if (std::holds_alternative<Rel>(f)) {
+            const auto rel {std::get<Rel>(f)};
+            switch (rel.op) {
+                case RelOp::Eq: res.addChild("=");
                 break;
-            case BoolOp::Or:
-                if (app->args.empty()) {
-                    return sexpresso::Sexp("false");
-                }
-                res.addChild("or");
+                case RelOp::Geq: res.addChild(">=");
                 break;
-            case BoolOp::Not:
-                res.addChild("not");
+                case RelOp::Gt: res.addChild(">");
                 break;
+                case RelOp::Leq: res.addChild("<=");
+                break;
+                case RelOp::Lt: res.addChild("<");
+                break;
+                case RelOp::Neq: res.addChild("distinct");
+                break;
+            }
+            res.addChild(to_sexp(rel.lhs, format));
+            res.addChild(to_sexp(rel.rhs, format));
+        } else if (std::holds_alternative<BoolAppPtr>(f)) {
+            const auto app {std::get<BoolAppPtr>(f)};
+            switch (app->op) {
+                case BoolOp::And:
+                    if (args.empty()) {
+                        return sexpresso::Sexp("true");
+                    }
+                    res.addChild("and");
+                    break;
+                case BoolOp::Or:
+                    if (args.empty()) {
+                        return sexpresso::Sexp("false");
+                    }
+                    res.addChild("or");
+                    break;
+                case BoolOp::Not:
+                    res.addChild("not");
+                    break;
+            }
+            for (auto &arg: args) {
+                res.addChild(std::move(arg));
+            }
+        } else if (std::holds_alternative<Exists>(f)) {
+            const auto ex {std::get<Exists>(f)};
+            res.addChild("exists");
+            sexpresso::Sexp decls;
+            for (const auto &x: ex.vars) {
+                sexpresso::Sexp decl;
+                decl.addChild(x.name());
+                decl.addChild("Int");
+                decls.addChild(decl);
+            }
+            res.addChild(decls);
+            res.addChild(std::move(args.front()));
+        } else {
+            throw std::invalid_argument("unknown formula");
         }
-        for (const auto &arg: app->args) {
-            res.addChild(to_sexp(arg));
-        }
-    } else if (std::holds_alternative<Exists>(f)) {
-        const auto ex {std::get<Exists>(f)};
-        res.addChild("exists");
-        sexpresso::Sexp decls;
-        for (const auto &x: ex.vars) {
-            sexpresso::Sexp decl;
-            decl.addChild(x);
-            decl.addChild("Int");
-            decls.addChild(decl);
-        }
-        res.addChild(decls);
-        res.addChild(to_sexp(*ex.matrix));
-    } else {
-        throw std::invalid_argument("unknown formula");
+        return res;
+    });
+}
+
+Expr traversal::rebuild(const Expr &e, std::span<const Expr> args) {
+    if (const auto app {std::get_if<ArithAppPtr>(&e)}) {
+        return mk_arith_app((*app)->op, args);
     }
-    return res;
+    return e;
 }
 
-/*
- * This function ignores precedences, which is fine for the examples from the TPDB f8460262, as there are no parantheses, but of course incorrect in general!
- */
-std::string to_koat(const Formula &f) {
-    std::string res;
-    std::string op;
-    if (std::holds_alternative<Rel>(f)) {
-        const auto rel {std::get<Rel>(f)};
-        switch (rel.op) {
-            case RelOp::Eq: op = "=";
-            break;
-            case RelOp::Geq: op = ">=";
-            break;
-            case RelOp::Gt: op = ">";
-            break;
-            case RelOp::Leq: op = "<=";
-            break;
-            case RelOp::Lt: op = "<";
-            break;
-            case RelOp::Neq: op = "!=";
-            break;
-        }
-        return to_koat(rel.lhs) + " " + op + " " + to_koat(rel.rhs);
-    } else if (std::holds_alternative<BoolAppPtr>(f)) {
-        const auto app {std::get<BoolAppPtr>(f)};
-        switch (app->op) {
-            case BoolOp::And: op = "&&";
-            break;
-            case BoolOp::Or: op = "||";
-            break;
-            case BoolOp::Not: throw std::invalid_argument(".koat does not allow negation");
-        }
-        for (const auto &arg: app->args) {
-            res += to_koat(arg) + " " + op + " ";
-        }
-        res = res.substr(0, res.size() - 4);
-    } else if (std::holds_alternative<Exists>(f)) {
-        return to_koat(*std::get<Exists>(f).matrix);
-    } else {
-        throw std::invalid_argument("unknown formula");
+Formula traversal::rebuild(const Formula &f, std::span<const Formula> args) {
+    if (const auto app {std::get_if<BoolAppPtr>(&f)}) {
+        return mk_bool_app((*app)->op, args);
+    } else if (const auto ex {std::get_if<Exists>(&f)}) {
+        return mk_exists(ex->vars, args.front());
     }
-    return res;
+    return f;
 }
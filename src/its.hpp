@@ -3,35 +3,70 @@
 #include <vector>
 #include <variant>
 #include <string>
-#include <map>
-#include <set>
+#include <unordered_set>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <span>
 
+#include "arena.hpp"
 #include "sexpresso.hpp"
+#include "symbol.hpp"
+
+class SexpWriter;
+class Sink;
+
+// Expressions and formulas are immutable trees whose nodes are owned by the arena of their ITS, so they can be copied
+// freely. The mk_* functions allocate in the arena of the current thread (see ArenaScope) and hash-cons the nodes, so
+// structurally equal subterms built in the same arena are shared, and their equality is pointer equality. Arenas that
+// have been merged via Arena::adopt may still contain duplicates. Unless Arena::preserve_shape is set for the current
+// arena, the mk_* functions flatten nested applications of +, *, and, and or into a single n-ary application.
 
 enum class ArithOp {
-    Plus, Minus, Times, UnaryMinus
+    // Pow has two arguments, the base and a non-negative integer literal as exponent
+    Plus, Minus, Times, UnaryMinus, Pow
+};
+
+// the s-expression based output formats, which differ in the encoding of powers
+enum class SexpFormat {
+    Ari, SMT2
 };
 
 struct ArithApp;
-using ArithAppPtr = std::shared_ptr<ArithApp>;
+using ArithAppPtr = const ArithApp*;
 
-using Expr = std::variant<ArithAppPtr, long, std::string>;
+using Expr = std::variant<ArithAppPtr, long, Symbol>;
 
-sexpresso::Sexp to_sexp(const Expr &f);
-std::string to_koat(const Expr &f);
-void collect_vars(const Expr &f, std::set<std::string>& vars);
+sexpresso::Sexp to_sexp(const Expr &f, const SexpFormat format = SexpFormat::Ari);
+// writes to_sexp(f, format) without building it
+void write_sexp(const Expr &f, const SexpFormat format, SexpWriter &out);
+// ignores precedences, which is fine for the examples from the TPDB f8460262, as there are no parantheses, but of course
+// incorrect in general! Only compound bases of powers and compound arguments of unary minus are parenthesized.
+void write_koat(const Expr &f, Sink &out);
+void collect_vars(const Expr &f, std::unordered_set<Symbol>& vars);
+// skips the nodes in visited, i.e., nodes whose variables have already been collected, and adds the traversed nodes
+void collect_vars(const Expr &f, std::unordered_set<Symbol>& vars, std::unordered_set<const void*> &visited);
 
 struct ArithApp {
     ArithOp op;
-    std::vector<Expr> args;
+    std::span<const Expr> args;
+};
+
+bool operator==(const ArithApp &x, const ArithApp &y);
+
+template <>
+struct std::hash<ArithApp> {
+    size_t operator()(const ArithApp &app) const;
 };
 
-Expr mk_arith_app(const ArithOp op, const std::vector<Expr> &args);
-Expr mk_plus(const std::vector<Expr> &args);
-Expr mk_times(const std::vector<Expr> &args);
-Expr mk_minus(const std::vector<Expr> &args);
+Expr mk_arith_app(const ArithOp op, std::span<const Expr> args);
+Expr mk_arith_app(const ArithOp op, const Expr &arg1, const Expr &arg2);
+Expr mk_plus(std::span<const Expr> args);
+Expr mk_times(std::span<const Expr> args);
+Expr mk_minus(std::span<const Expr> args);
 Expr mk_unary_minus(const Expr &arg);
+Expr mk_pow(const Expr &base, const long exponent);
 
 enum class RelOp {
     Lt, Leq, Eq, Neq, Geq, Gt
@@ -41,6 +76,8 @@ struct Rel {
     Expr lhs;
     RelOp op;
     Expr rhs;
+
+    bool operator==(const Rel&) const = default;
 };
 
 enum class BoolOp {
@@ -48,42 +85,66 @@ enum class BoolOp {
 };
 
 struct BoolApp;
-using BoolAppPtr = std::shared_ptr<BoolApp>;
+using BoolAppPtr = const BoolApp*;
 struct Exists;
 
 using Formula = std::variant<BoolAppPtr, Rel, Exists>;
 
-sexpresso::Sexp to_sexp(const Formula &f);
-std::string to_koat(const Formula &f);
-void collect_vars(const Formula &f, std::set<std::string>& vars);
+struct Exists {
+    std::span<const Symbol> vars;
+    const Formula *matrix;
+};
+
+bool operator==(const Exists &x, const Exists &y);
+
+template <>
+struct std::hash<Rel> {
+    size_t operator()(const Rel &rel) const;
+};
+
+template <>
+struct std::hash<Exists> {
+    size_t operator()(const Exists &ex) const;
+};
+
+sexpresso::Sexp to_sexp(const Formula &f, const SexpFormat format = SexpFormat::Ari);
+void write_sexp(const Formula &f, const SexpFormat format, SexpWriter &out);
+void write_koat(const Formula &f, Sink &out);
+void collect_vars(const Formula &f, std::unordered_set<Symbol>& vars);
+void collect_vars(const Formula &f, std::unordered_set<Symbol>& vars, std::unordered_set<const void*> &visited);
 
 bool is_true(const Formula &f);
 
 struct BoolApp {
     BoolOp op;
-    std::vector<Formula> args;
+    std::span<const Formula> args;
 };
 
-Formula mk_bool_app(const BoolOp op, const std::vector<Formula> &args);
-Formula mk_and(const std::vector<Formula> &args);
-Formula mk_or(const std::vector<Formula> &args);
-Formula mk_not(const Formula &arg);
+bool operator==(const BoolApp &x, const BoolApp &y);
 
-extern Formula True;
-extern Formula False;
-
-struct Exists {
-    std::vector<std::string> vars;
-    std::shared_ptr<Formula> matrix;
+template <>
+struct std::hash<BoolApp> {
+    size_t operator()(const BoolApp &app) const;
 };
 
+Formula mk_bool_app(const BoolOp op, std::span<const Formula> args);
+Formula mk_bool_app(const BoolOp op, const Formula &arg1, const Formula &arg2);
+Formula mk_and(std::span<const Formula> args);
+Formula mk_or(std::span<const Formula> args);
+Formula mk_not(const Formula &arg);
+Formula mk_exists(std::span<const Symbol> vars, const Formula &matrix);
+
+// statically allocated, so they do not belong to any arena
+extern const Formula True;
+extern const Formula False;
+
 struct Lhs {
-    std::string location;
-    std::vector<std::string> args;
+    Symbol location;
+    std::vector<Symbol> args;
 };
 
 struct Rhs {
-    std::string location;
+    Symbol location;
     std::vector<Expr> args;
 };
 
@@ -93,14 +154,78 @@ struct Rule {
     Formula cond;
 };
 
-struct ITS {
-    std::string init;
-    std::vector<Rule> rules;
+/**
+ * existentially quantifies all variables that occur in the condition, but neither in the left- nor in the right-hand side
+ */
+void quantify_free_vars(Rule &r);
 
-    std::map<std::string, unsigned> locations() const;
-    std::set<std::string> vars() const;
+/**
+ * The locations and variables of the rules are indexed when the rules are added, and the sorted views for the output
+ * are computed on demand. The const member functions can be called concurrently.
+ */
+class ITS {
+
+    std::vector<Rule> rules;
+    // the arity of each location, as given by its first occurrence
+    std::unordered_map<Symbol, unsigned> arities;
+    std::unordered_set<Symbol> variables;
+
+    struct SortedViews {
+        std::mutex mutex;
+        std::optional<std::vector<std::pair<Symbol, unsigned>>> locations;
+        std::optional<std::vector<Symbol>> vars;
+    };
+
+    // separate, so that ITSs can be moved
+    std::unique_ptr<SortedViews> views {std::make_unique<SortedViews>()};
+
+    void invalidate_views();
+
+public:
+
+    Symbol init;
+    // owns the nodes of the expressions and formulas of the rules
+    std::unique_ptr<Arena> arena {std::make_unique<Arena>()};
+
+    const std::vector<Rule>& get_rules() const;
+    void add_rule(Rule rule);
+    /**
+     * appends the rules of other and takes over its arena, but not its initial location
+     */
+    void append(ITS &&other);
+    /**
+     * removes all rules and returns them
+     */
+    std::vector<Rule> take_rules();
+
+    // all locations with their arities, sorted by name, valid until the rules are modified
+    const std::vector<std::pair<Symbol, unsigned>>& locations() const;
+    // all variables, sorted by name, valid until the rules are modified
+    const std::vector<Symbol>& vars() const;
     sexpresso::Sexp to_ari() const;
     sexpresso::Sexp to_its() const;
-    std::string to_koat() const;
+    // throws std::invalid_argument if the ITS cannot be written as koat, which write_koat checks before writing anything
+    void check_koat() const;
+    // the write_* functions format ranges of rules concurrently on up to threads threads, see write_concurrently
+    void write_koat(Sink &out, const unsigned threads = 1) const;
+    // write the elements of to_ari() resp. to_its() one by one, without building them
+    void write_ari(SexpWriter &out, const unsigned threads = 1) const;
+    void write_its(SexpWriter &out, const unsigned threads = 1) const;
 
 };
+
+// building blocks of the serializers that do not depend on the representation of expressions and formulas
+
+bool is_identifier(const std::string &s);
+// escapes identifiers that are not valid symbols in the ari format
+std::string escape(const std::string &s);
+sexpresso::Sexp ari_declarations(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations);
+sexpresso::Sexp ari_lhs(const Lhs &lhs);
+// base^exponent, as a product in the ari format, and via repeated squaring in the smt2 format if that is shorter
+sexpresso::Sexp pow_to_sexp(const sexpresso::Sexp &base, const long exponent, const SexpFormat format);
+// the transition from -> to with the given condition, as disjunct of next_main
+sexpresso::Sexp its_transition(const Symbol from, const Symbol to, sexpresso::Sexp cond);
+sexpresso::Sexp its_system(const Symbol init, const std::vector<std::pair<Symbol, unsigned>> &locations, std::span<const Symbol> pre_vars, std::span<const Symbol> post_vars, sexpresso::Sexp disj);
+void write_koat_declarations(const Symbol init, const std::vector<Symbol> &vars, Sink &out);
+// the left-hand side of a rule, including the arrow
+void write_koat_lhs(const Lhs &lhs, Sink &out);
@@ -2,27 +2,41 @@
 #include "KoatLexer.h"
 #include "KoatParser.h"
 #include "KoatParseVisitor.h"
+#include "mappedfile.hpp"
 
 using namespace antlr4;
 
 using namespace parser;
 
-ITS ITSParser::loadFromFile(const std::string &filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        throw std::invalid_argument("Unable to open file: " + filename);
-    }
-    ANTLRInputStream input(file);
+ITS ITSParser::loadFromFile(const std::string &filename, const bool preserve_shape) {
+    const MappedFile file(filename);
+    ANTLRInputStream input(file.view());
     KoatLexer lexer(&input);
     CommonTokenStream tokens(&lexer);
     tokens.fill();
     KoatParser parser(&tokens);
     parser.setBuildParseTree(true);
-    KoatParseVisitor vis;
-    auto ctx = parser.main();
+    // First try the cheaper SLL prediction, which bails out on the first syntax error. It sufficed for all valid koat
+    // files we tried, so we only have to re-parse with full LL prediction (and proper error reporting) if it fails.
+    parser.getInterpreter<atn::ParserATNSimulator>()->setPredictionMode(atn::PredictionMode::SLL);
+    parser.setErrorHandler(std::make_shared<BailErrorStrategy>());
+    parser.removeErrorListeners();
+    KoatParser::MainContext *ctx;
+    try {
+        ctx = parser.main();
+    } catch (const ParseCancellationException&) {
+        parser.reset();
+        parser.getInterpreter<atn::ParserATNSimulator>()->setPredictionMode(atn::PredictionMode::LL);
+        parser.setErrorHandler(std::make_shared<DefaultErrorStrategy>());
+        parser.addErrorListener(&ConsoleErrorListener::INSTANCE);
+        ctx = parser.main();
+    }
     if (parser.getNumberOfSyntaxErrors() > 0) {
         throw std::invalid_argument("parsing failed");
-    } else {
-        return std::any_cast<ITS>(vis.visit(ctx));
     }
+    KoatParseVisitor vis;
+    vis.result().arena->preserve_shape = preserve_shape;
+    const ArenaScope scope(*vis.result().arena);
+    vis.visit(ctx);
+    return std::move(vis.result());
 }
@@ -9,7 +9,7 @@ namespace parser {
 class ITSParser {
 public:
 
-    static ITS loadFromFile(const std::string &path);
+    static ITS loadFromFile(const std::string &path, const bool preserve_shape = false);
 
 };
 
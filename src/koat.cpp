@@ -0,0 +1,516 @@
+#include "koat.hpp"
+#include "mappedfile.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+
+using namespace koat;
+
+namespace {
+
+    bool is_id_start(const char c) {
+        return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+    }
+
+    bool is_digit(const char c) {
+        return '0' <= c && c <= '9';
+    }
+
+    bool is_id_char(const char c) {
+        return is_id_start(c) || is_digit(c) || c == '.' || c == '\'';
+    }
+
+    // like ANTLR, prefer keywords over identifiers of the same length
+    TokenKind keyword(const std::string_view s) {
+        if (s == "GOAL") {
+            return TokenKind::Goal;
+        } else if (s == "COMPLEXITY") {
+            return TokenKind::Cpx;
+        } else if (s == "TERMINATION") {
+            return TokenKind::Term;
+        } else if (s == "STARTTERM") {
+            return TokenKind::Start;
+        } else if (s == "SINKTERM") {
+            return TokenKind::Sink;
+        } else if (s == "FUNCTIONSYMBOLS") {
+            return TokenKind::Fs;
+        } else if (s == "VAR") {
+            return TokenKind::Var;
+        } else if (s == "RULES") {
+            return TokenKind::Rules;
+        } else if (s.size() > 4 && s.starts_with("Com_") && std::all_of(s.begin() + 4, s.end(), is_digit)) {
+            return TokenKind::Com;
+        }
+        return TokenKind::Id;
+    }
+
+}
+
+Lexer::Lexer(std::string_view input): input(input) {}
+
+Token Lexer::next() {
+    while (pos < input.size()) {
+        const auto c {input[pos]};
+        if (c == '\n') {
+            ++line;
+            ++pos;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            ++pos;
+        } else if (c == '#') {
+            while (pos < input.size() && input[pos] != '\n' && input[pos] != '\r') {
+                ++pos;
+            }
+            // like in Koat.g4, comments end with a line break
+            if (pos == input.size()) {
+                throw std::invalid_argument("parsing failed in line " + std::to_string(line) + ": unterminated comment");
+            }
+        } else {
+            break;
+        }
+    }
+    if (pos == input.size()) {
+        return {TokenKind::End, {}, line};
+    }
+    const auto start {pos};
+    const auto c {input[pos]};
+    const auto follows {[&](const char d) {
+        return pos + 1 < input.size() && input[pos + 1] == d;
+    }};
+    const auto token {[&](const TokenKind kind, const size_t len) {
+        pos += len;
+        return Token{kind, input.substr(start, len), line};
+    }};
+    switch (c) {
+        case '+': return token(TokenKind::Plus, 1);
+        case '-': return follows('>') ? token(TokenKind::To, 2) : token(TokenKind::Minus, 1);
+        case '*': return follows('*') ? token(TokenKind::Exp, 2) : token(TokenKind::Times, 1);
+        case '^': return token(TokenKind::Exp, 1);
+        case '(': return token(TokenKind::LPar, 1);
+        case ')': return token(TokenKind::RPar, 1);
+        case '[': return token(TokenKind::LBrack, 1);
+        case ']': return token(TokenKind::RBrack, 1);
+        case '{': return token(TokenKind::LCurl, 1);
+        case '}': return token(TokenKind::RCurl, 1);
+        case ',': return token(TokenKind::Comma, 1);
+        case '<': return follows('=') ? token(TokenKind::Leq, 2) : token(TokenKind::Lt, 1);
+        case '>': return follows('=') ? token(TokenKind::Geq, 2) : token(TokenKind::Gt, 1);
+        case '=': return follows('=') ? token(TokenKind::Eq, 2) : token(TokenKind::Eq, 1);
+        case '!':
+            if (follows('=')) {
+                return token(TokenKind::Neq, 2);
+            }
+            break;
+        case '/':
+            if (follows('\\')) {
+                return token(TokenKind::And, 2);
+            }
+            break;
+        case '\\':
+            if (follows('/')) {
+                return token(TokenKind::Or, 2);
+            }
+            break;
+        case '&':
+            if (follows('&')) {
+                return token(TokenKind::And, 2);
+            }
+            break;
+        case '|':
+            if (follows('|')) {
+                return token(TokenKind::Or, 2);
+            }
+            break;
+        case ':':
+            if (input.substr(pos, 3) == ":|:") {
+                return token(TokenKind::CondSep, 3);
+            }
+            break;
+        default:
+            if (is_digit(c)) {
+                auto end {pos};
+                while (end < input.size() && is_digit(input[end])) {
+                    ++end;
+                }
+                return token(TokenKind::Int, end - pos);
+            } else if (is_id_start(c)) {
+                auto end {pos};
+                while (end < input.size() && is_id_char(input[end])) {
+                    ++end;
+                }
+                return token(keyword(input.substr(pos, end - pos)), end - pos);
+            }
+    }
+    throw std::invalid_argument("parsing failed in line " + std::to_string(line) + ": unexpected character '" + c + "'");
+}
+
+Parser::Parser(std::string_view input): lexer(input), la{lexer.next(), lexer.next()} {}
+
+const Token& Parser::peek(unsigned i) const {
+    return la[i];
+}
+
+Token Parser::next() {
+    const auto res {la[0]};
+    la[0] = la[1];
+    la[1] = lexer.next();
+    return res;
+}
+
+void Parser::fail(const std::string &what) const {
+    const auto &tok {peek()};
+    const auto found {tok.kind == TokenKind::End ? std::string{"end of file"} : "'" + std::string{tok.text} + "'"};
+    throw std::invalid_argument("parsing failed in line " + std::to_string(tok.line) + ": expected " + what + ", found " + found);
+}
+
+Token Parser::expect(const TokenKind kind, const std::string &what) {
+    if (peek().kind != kind) {
+        fail(what);
+    }
+    return next();
+}
+
+void Parser::parse() {
+    if (peek().kind == TokenKind::LPar && peek(1).kind == TokenKind::Goal) {
+        parse_goal();
+    }
+    its.init = parse_start(TokenKind::Start);
+    if (peek().kind == TokenKind::LPar && peek(1).kind == TokenKind::Sink) {
+        // KoatParseVisitor overrides the start symbol with the sink symbol, so we do the same
+        its.init = parse_start(TokenKind::Sink);
+    }
+    parse_vardecl();
+    parse_transs();
+}
+
+void Parser::parse_goal() {
+    expect(TokenKind::LPar, "'('");
+    expect(TokenKind::Goal, "GOAL");
+    if (peek().kind != TokenKind::Cpx && peek().kind != TokenKind::Term) {
+        fail("COMPLEXITY or TERMINATION");
+    }
+    next();
+    expect(TokenKind::RPar, "')'");
+}
+
+Symbol Parser::parse_start(const TokenKind kind) {
+    expect(TokenKind::LPar, "'('");
+    expect(kind, kind == TokenKind::Start ? "STARTTERM" : "SINKTERM");
+    expect(TokenKind::LPar, "'('");
+    expect(TokenKind::Fs, "FUNCTIONSYMBOLS");
+    const auto fs {expect(TokenKind::Id, "function symbol")};
+    expect(TokenKind::RPar, "')'");
+    expect(TokenKind::RPar, "')'");
+    return Symbol(fs.text);
+}
+
+void Parser::parse_vardecl() {
+    expect(TokenKind::LPar, "'('");
+    expect(TokenKind::Var, "VAR");
+    expect(TokenKind::Id, "variable");
+    while (peek().kind == TokenKind::Id) {
+        next();
+    }
+    expect(TokenKind::RPar, "')'");
+}
+
+void Parser::parse_transs() {
+    expect(TokenKind::LPar, "'('");
+    expect(TokenKind::Rules, "RULES");
+    while (peek().kind == TokenKind::Id) {
+        its.add_rule(parse_trans());
+    }
+    expect(TokenKind::RPar, "')'");
+}
+
+Rule Parser::parse_trans() {
+    Rule r;
+    r.lhs = parse_lhs();
+    parse_to();
+    r.rhs = parse_com();
+    if (peek().kind == TokenKind::CondSep) {
+        next();
+        r.cond = parse_formula();
+    } else if (peek().kind == TokenKind::LBrack) {
+        next();
+        r.cond = parse_formula();
+        expect(TokenKind::RBrack, "']'");
+    } else {
+        r.cond = True;
+    }
+    quantify_free_vars(r);
+    return r;
+}
+
+Lhs Parser::parse_lhs() {
+    Lhs lhs;
+    lhs.location = Symbol(expect(TokenKind::Id, "function symbol").text);
+    expect(TokenKind::LPar, "'('");
+    if (peek().kind != TokenKind::RPar) {
+        lhs.args.emplace_back(expect(TokenKind::Id, "variable").text);
+        while (peek().kind == TokenKind::Comma) {
+            next();
+            lhs.args.emplace_back(expect(TokenKind::Id, "variable").text);
+        }
+    }
+    expect(TokenKind::RPar, "')'");
+    return lhs;
+}
+
+void Parser::parse_to() {
+    if (peek().kind == TokenKind::To) {
+        next();
+        return;
+    }
+    // bounds on the cost of the transition are ignored
+    expect(TokenKind::Minus, "'->'");
+    expect(TokenKind::LCurl, "'{'");
+    parse_expr();
+    if (peek().kind == TokenKind::Comma) {
+        next();
+        parse_expr();
+    }
+    expect(TokenKind::RCurl, "'}'");
+    expect(TokenKind::Gt, "'>'");
+}
+
+Rhs Parser::parse_com() {
+    if (peek().kind != TokenKind::Com) {
+        return parse_rhs();
+    }
+    next();
+    expect(TokenKind::LPar, "'('");
+    if (peek().kind == TokenKind::RPar) {
+        fail("right-hand side");
+    }
+    auto rhs {parse_rhs()};
+    if (peek().kind == TokenKind::Comma) {
+        throw std::invalid_argument("Com-symbols are not supported");
+    }
+    expect(TokenKind::RPar, "')'");
+    return rhs;
+}
+
+Rhs Parser::parse_rhs() {
+    Rhs rhs;
+    rhs.location = Symbol(expect(TokenKind::Id, "function symbol").text);
+    expect(TokenKind::LPar, "'('");
+    if (peek().kind != TokenKind::RPar) {
+        rhs.args.push_back(parse_expr());
+        while (peek().kind == TokenKind::Comma) {
+            next();
+            rhs.args.push_back(parse_expr());
+        }
+    }
+    expect(TokenKind::RPar, "')'");
+    return rhs;
+}
+
+/*
+ * In Koat.g4, the alternatives of formula and expr are left-recursive, so ANTLR assigns decreasing precedences to
+ * them in the order in which they are listed, and all binary operators are left-associative. Hence && binds stronger
+ * than ||, and for expressions, the precedences from strongest to weakest are: unary -, ^, *, +, binary -.
+ * In particular, a - b + c is parsed as a - (b + c). Relations bind weaker than all arithmetic operators and stronger
+ * than the connectives.
+ *
+ * parse_term implements these precedences with explicit stacks of operands and pending operators, so that the depth
+ * of the input is only limited by the heap. A pending operator is applied as soon as an operator follows that does
+ * not bind stronger, which yields the same trees as precedence climbing. Chains of +, *, &&, and || are applied at
+ * once, unless Arena::preserve_shape is set, as the mk_* functions would flatten them anyway.
+ *
+ * A '(' in formula position may enclose a formula, as in (x < 1 && y < 2) || z < 3, or an expression, as in
+ * (x + 1) * 2 < y. Instead of looking ahead for the matching ')', its content is parsed as either of them, and the
+ * result determines how parsing continues after the ')'. Elsewhere, relations and connectives end the current term,
+ * like all other tokens that cannot continue it.
+ */
+
+namespace {
+
+    constexpr unsigned relation_prec {3};
+    constexpr unsigned unary_minus_prec {8};
+
+    // the precedence of the binary operator kind, or 0 if kind is not a binary operator
+    unsigned prec(const TokenKind kind) {
+        switch (kind) {
+            case TokenKind::Or: return 1;
+            case TokenKind::And: return 2;
+            case TokenKind::Lt:
+            case TokenKind::Leq:
+            case TokenKind::Eq:
+            case TokenKind::Neq:
+            case TokenKind::Geq:
+            case TokenKind::Gt:
+                return relation_prec;
+            case TokenKind::Minus: return 4;
+            case TokenKind::Plus: return 5;
+            case TokenKind::Times: return 6;
+            case TokenKind::Exp: return 7;
+            default: return 0;
+        }
+    }
+
+    bool is_associative(const TokenKind kind) {
+        return kind == TokenKind::Plus || kind == TokenKind::Times || kind == TokenKind::And || kind == TokenKind::Or;
+    }
+
+    RelOp to_rel_op(const TokenKind kind) {
+        switch (kind) {
+            case TokenKind::Lt: return RelOp::Lt;
+            case TokenKind::Leq: return RelOp::Leq;
+            case TokenKind::Eq: return RelOp::Eq;
+            case TokenKind::Neq: return RelOp::Neq;
+            case TokenKind::Geq: return RelOp::Geq;
+            default: return RelOp::Gt;
+        }
+    }
+
+}
+
+Formula Parser::parse_formula() {
+    parse_term(true);
+    if (!is_formula.back()) {
+        fail("relation");
+    }
+    return formulas.back();
+}
+
+Expr Parser::parse_expr() {
+    parse_term(false);
+    return exprs.back();
+}
+
+void Parser::parse_term(const bool formula) {
+    ops.clear();
+    exprs.clear();
+    formulas.clear();
+    is_formula.clear();
+    const auto in_formula {[&] {
+        return ops.empty() ? formula : ops.back().formula;
+    }};
+    const auto op_prec {[](const PendingOp &op) {
+        return op.kind == TokenKind::LPar ? 0 : op.arity == 1 ? unary_minus_prec : prec(op.kind);
+    }};
+    unsigned open {0};
+    while (true) {
+        // an operand, preceded by '(' and unary -
+        for (auto kind {peek().kind}; kind == TokenKind::LPar || kind == TokenKind::Minus; kind = peek().kind) {
+            const auto line {next().line};
+            if (kind == TokenKind::Minus) {
+                ops.push_back({kind, line, 1, in_formula()});
+            } else {
+                const auto top {ops.empty() ? TokenKind::LPar : ops.back().kind};
+                const auto formula_pos {in_formula() && (top == TokenKind::LPar || top == TokenKind::And || top == TokenKind::Or)};
+                ops.push_back({kind, line, 0, formula_pos});
+                ++open;
+            }
+        }
+        switch (peek().kind) {
+            case TokenKind::Id:
+                exprs.emplace_back(Symbol(next().text));
+                break;
+            case TokenKind::Int:
+                exprs.emplace_back(std::stol(std::string{next().text}));
+                break;
+            default:
+                fail("expression");
+        }
+        is_formula.push_back(false);
+        // the operator after the operand, or the ')' of the parentheses that end with it
+        while (true) {
+            const auto kind {peek().kind};
+            if (kind == TokenKind::RPar && open > 0) {
+                while (ops.back().kind != TokenKind::LPar) {
+                    reduce();
+                }
+                ops.pop_back();
+                --open;
+                next();
+                continue;
+            }
+            const auto p {prec(kind)};
+            const auto ends {p == 0 || (p >= relation_prec && is_formula.back()) || (p <= relation_prec && !in_formula())};
+            if (!ends) {
+                while (!ops.empty() && op_prec(ops.back()) > p) {
+                    reduce();
+                }
+            }
+            // relations cannot be chained
+            if (ends || (p == relation_prec && !ops.empty() && op_prec(ops.back()) == p)) {
+                while (!ops.empty()) {
+                    if (ops.back().kind == TokenKind::LPar) {
+                        fail("')'");
+                    }
+                    reduce();
+                }
+                return;
+            }
+            if (p < relation_prec && !is_formula.back()) {
+                fail("relation");
+            }
+            const auto line {next().line};
+            if (!ops.empty() && op_prec(ops.back()) == p) {
+                if (!its.arena->preserve_shape && is_associative(kind)) {
+                    ++ops.back().arity;
+                    break;
+                }
+                reduce();
+            }
+            ops.push_back({kind, line, 2, in_formula()});
+            break;
+        }
+    }
+}
+
+void Parser::reduce() {
+    const auto op {ops.back()};
+    ops.pop_back();
+    if (op.kind == TokenKind::And || op.kind == TokenKind::Or) {
+        const auto first {is_formula.end() - op.arity};
+        if (std::find(first, is_formula.end(), false) != is_formula.end()) {
+            fail("relation");
+        }
+        is_formula.erase(first + 1, is_formula.end());
+        const std::span args {formulas.end() - op.arity, formulas.end()};
+        auto res {mk_bool_app(op.kind == TokenKind::And ? BoolOp::And : BoolOp::Or, args)};
+        formulas.erase(formulas.end() - op.arity, formulas.end());
+        formulas.push_back(std::move(res));
+        return;
+    }
+    // the operands of all other operators are expressions
+    if (op.arity == 1) {
+        exprs.back() = mk_unary_minus(exprs.back());
+        return;
+    }
+    is_formula.erase(is_formula.end() - op.arity + 1, is_formula.end());
+    const auto first {exprs.end() - op.arity};
+    if (prec(op.kind) == relation_prec) {
+        formulas.push_back(Rel{std::move(first[0]), to_rel_op(op.kind), std::move(first[1])});
+        exprs.erase(first, exprs.end());
+        is_formula.back() = true;
+        return;
+    }
+    Expr res;
+    switch (op.kind) {
+        case TokenKind::Exp:
+            if (!std::holds_alternative<long>(first[1])) {
+                throw std::invalid_argument("parsing failed in line " + std::to_string(op.line) + ": exponents must be integer literals");
+            }
+            res = mk_pow(first[0], std::max(std::get<long>(first[1]), 0L));
+            break;
+        case TokenKind::Times: res = mk_times({first, exprs.end()});
+        break;
+        case TokenKind::Plus: res = mk_plus({first, exprs.end()});
+        break;
+        default: res = mk_minus({first, exprs.end()});
+    }
+    exprs.erase(first, exprs.end());
+    exprs.push_back(std::move(res));
+}
+
+ITS Parser::loadFromFile(const std::string &filename, const bool preserve_shape) {
+    const MappedFile file(filename);
+    Parser parser(file.view());
+    parser.its.arena->preserve_shape = preserve_shape;
+    const ArenaScope scope(*parser.its.arena);
+    parser.parse();
+    return std::move(parser.its);
+}
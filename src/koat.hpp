@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "its.hpp"
+
+namespace koat {
+
+enum class TokenKind {
+    Com, Goal, Cpx, Term, Start, Sink, Fs, Var, Rules,
+    Plus, Minus, Times, Exp,
+    LPar, RPar, LBrack, RBrack, LCurl, RCurl,
+    To, Comma, And, Or,
+    Lt, Leq, Eq, Neq, Geq, Gt,
+    CondSep, Id, Int, End
+};
+
+struct Token {
+    TokenKind kind;
+    std::string_view text;
+    unsigned line;
+};
+
+/**
+ * Splits its input into the tokens defined in grammars/Koat.g4, skipping whitespace and comments.
+ */
+class Lexer {
+
+    std::string_view input;
+    size_t pos {0};
+    unsigned line {1};
+
+public:
+
+    explicit Lexer(std::string_view input);
+
+    Token next();
+
+};
+
+/**
+ * Hand-written alternative to parser::ITSParser that does not depend on ANTLR.
+ *
+ * It accepts the grammar from grammars/Koat.g4, resolves precedences and associativity exactly like the parser that
+ * ANTLR generates from it, and builds the same ITS as KoatParseVisitor.
+ */
+class Parser {
+
+    Lexer lexer;
+    Token la[2];
+    ITS its;
+
+    Parser(std::string_view input);
+
+    const Token& peek(unsigned i = 0) const;
+    Token next();
+    Token expect(const TokenKind kind, const std::string &what);
+    [[noreturn]] void fail(const std::string &what) const;
+
+    void parse();
+    void parse_goal();
+    Symbol parse_start(const TokenKind kind);
+    void parse_vardecl();
+    void parse_transs();
+    Rule parse_trans();
+    Lhs parse_lhs();
+    void parse_to();
+    Rhs parse_com();
+    Rhs parse_rhs();
+    Formula parse_formula();
+    Expr parse_expr();
+    // parses a formula if formula is set, and an expression otherwise, and leaves it on the stack of operands
+    void parse_term(const bool formula);
+    // applies the topmost pending operator to its operands
+    void reduce();
+
+    // an operator of parse_term whose operands have not been parsed completely, where the arity of '(' is 0 and the
+    // arity of unary - is 1
+    struct PendingOp {
+        TokenKind kind;
+        unsigned line;
+        unsigned arity;
+        // whether relations and connectives are allowed within the innermost parentheses around the operator resp.
+        // within the parentheses opened by '('
+        bool formula;
+    };
+
+    // the stacks of parse_term, which are reused by all calls
+    std::vector<PendingOp> ops;
+    std::vector<Expr> exprs;
+    std::vector<Formula> formulas;
+    // whether the operands, from bottom to top, are formulas or expressions
+    std::vector<bool> is_formula;
+
+public:
+
+    // the resulting ITS preserves the shape of its input if preserve_shape is set
+    static ITS loadFromFile(const std::string &filename, const bool preserve_shape = false);
+
+};
+
+}
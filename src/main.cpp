@@ -1,28 +1,94 @@
+#ifdef HAS_ANTLR
 #include "itsparser.hpp"
+#endif
+#include "koat.hpp"
 #include "ariparser.hpp"
 #include "sexpresso.hpp"
 #include "parser.hpp"
+#include "flat.hpp"
+#include "polynomial.hpp"
+#include "writer.hpp"
+#include "parallel.hpp"
 #include <iostream>
 #include <assert.h>
 #include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <utility>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 void print_help() {
-    std::cout << "usage: its-conversion --to [ari|koat|smt2] $INPUT.[ari|koat|smt2]" << std::endl;
+    std::cout << "usage: its-conversion --to [ari|koat|smt2](,[ari|koat|smt2])* $INPUT.[ari|koat|smt2]" << std::endl;
     std::cout << "optional arguments:" << std::endl;
+    std::cout << "  --output FORMAT=FILE: writes the given output format to FILE instead of stdout (can be repeated)" << std::endl;
     std::cout << "  --indent: enables indentation in sexpressions" << std::endl;
+    std::cout << "  --parser [native|generic]: native (default) parses ari and koat directly into an ITS, generic uses s-expressions resp. ANTLR" << std::endl;
+    std::cout << "  --threads N: parses large ari and smt2 files, and writes large outputs, with up to N threads (default: number of cores)" << std::endl;
+    std::cout << "  --preserve-shape: keeps nested applications of associative operators instead of flattening them" << std::endl;
+    std::cout << "  --normalize: replaces all arithmetic expressions by their polynomial normal forms" << std::endl;
+    std::cout << "  --flat: converts the ITS into a flat array-based representation before output" << std::endl;
+    std::cout << "  --stats: prints the time spent on parsing and on output, and the peak memory usage, to stderr" << std::endl;
     exit(0);
 }
 
+// an output format, and where to write it
+struct Target {
+    std::string format;
+    std::string path {};
+    // the file that is written instead of path, if any, and renamed to path once all targets have been written
+    std::string temp_path {};
+    int fd {STDOUT_FILENO};
+};
+
 int main(int argc, char *argv[]) {
     bool parse_to {false};
+    bool parse_output {false};
+    bool parse_parser {false};
+    bool parse_threads {false};
     bool indent {false};
-    std::string to, filename;
+    bool stats {false};
+    bool flat {false};
+    bool normal_form {false};
+    bool preserve_shape {false};
+    unsigned threads {std::max(std::thread::hardware_concurrency(), 1u)};
+    std::string to, filename, parser_name {"native"};
+    std::vector<std::string> outputs;
     for (int i = 0; i < argc; ++i) {
         if (parse_to) {
             to = argv[i];
             parse_to = false;
+        } else if (parse_output) {
+            outputs.emplace_back(argv[i]);
+            parse_output = false;
+        } else if (parse_parser) {
+            parser_name = argv[i];
+            parse_parser = false;
+        } else if (parse_threads) {
+            threads = std::max(std::atoi(argv[i]), 1);
+            parse_threads = false;
         } else if (strcmp(argv[i], "--to") == 0) {
             parse_to = true;
+        } else if (strcmp(argv[i], "--output") == 0) {
+            parse_output = true;
+        } else if (strcmp(argv[i], "--parser") == 0) {
+            parse_parser = true;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            parse_threads = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(argv[i], "--preserve-shape") == 0) {
+            preserve_shape = true;
+        } else if (strcmp(argv[i], "--normalize") == 0) {
+            normal_form = true;
+        } else if (strcmp(argv[i], "--flat") == 0) {
+            flat = true;
         } else if (strcmp(argv[i], "--help") == 0) {
             print_help();
         } else if (strcmp(argv[i], "--indent") == 0) {
@@ -31,42 +97,161 @@ int main(int argc, char *argv[]) {
             filename = argv[i];
         }
     }
-    if (filename.empty() || to.empty()) {
+    if (filename.empty() || to.empty() || (parser_name != "native" && parser_name != "generic")) {
         print_help();
     }
+    std::vector<Target> targets;
+    for (size_t begin = 0; begin <= to.size();) {
+        const auto end {std::min(to.find(',', begin), to.size())};
+        targets.push_back({to.substr(begin, end - begin)});
+        if (targets.back().format != "ari" && targets.back().format != "koat" && targets.back().format != "smt2") {
+            std::cout << "unknown ouput format " << targets.back().format << std::endl;
+            print_help();
+        }
+        begin = end + 1;
+    }
+    for (const auto &o: outputs) {
+        const auto eq {o.find('=')};
+        const auto target {std::find_if(targets.begin(), targets.end(), [&](const Target &t) {
+            return eq != std::string::npos && t.format == o.substr(0, eq);
+        })};
+        if (target == targets.end()) {
+            std::cout << "--output " << o << " does not refer to a format from --to" << std::endl;
+            print_help();
+        }
+        target->path = o.substr(eq + 1);
+    }
+    const auto generic {parser_name == "generic"};
+    auto start {std::chrono::steady_clock::now()};
+    const auto report {[&](const std::string &phase) {
+        if (stats) {
+            const auto now {std::chrono::steady_clock::now()};
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            // ru_maxrss is in kilobytes on Linux
+            std::cerr << phase << ": " << std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count() << " ms, peak RSS: " << usage.ru_maxrss / 1024 << " MB" << std::endl;
+            start = now;
+        }
+    }};
     ITS its;
     if (filename.ends_with(".koat")) {
-        its = parser::ITSParser::loadFromFile(filename);
+        if (!generic) {
+            its = koat::Parser::loadFromFile(filename, preserve_shape);
+        } else {
+#ifdef HAS_ANTLR
+            its = parser::ITSParser::loadFromFile(filename, preserve_shape);
+#else
+            std::cout << "the generic koat parser requires ANTLR, which was not available at build time" << std::endl;
+            print_help();
+#endif
+        }
     } else if (filename.ends_with(".ari")) {
-        its = AriParser::loadFromFile(filename);
+        its = AriParser::loadFromFile(filename, generic, threads, preserve_shape);
     } else if (filename.ends_with(".smt2")) {
-        its = sexpressionparser::Parser::loadFromFile(filename);
+        its = sexpressionparser::Parser::loadFromFile(filename, threads, preserve_shape);
     } else {
         std::cout << "unknown input format" << std::endl;
         print_help();
     }
-    if (to == "ari") {
-        auto ari{its.to_ari()};
-        for (unsigned i = 0; i < ari.childCount(); ++i) {
-            if (indent) {
-                std::cout << ari.getChild(i).toString();
-            } else {
-                std::cout << ari.getChild(i).toCompactString();
+    report("parsing");
+    if (normal_form) {
+        normalize(its);
+        report("normalization");
+    }
+    // koat does not allow negation, which is checked before any file is touched
+    if (std::any_of(targets.begin(), targets.end(), [](const Target &t) {
+        return t.format == "koat";
+    })) {
+        its.check_koat();
+    }
+    // regular files are only replaced once all targets have been written, so that they are kept if anything fails
+    const auto discard_files {[&] {
+        for (auto &t: targets) {
+            if (!t.path.empty()) {
+                ::close(std::exchange(t.fd, -1));
+            }
+            if (!t.temp_path.empty()) {
+                ::unlink(t.temp_path.c_str());
+                t.temp_path.clear();
             }
         }
-    } else if (to == "koat") {
-        std::cout << its.to_koat();
-    } else if (to == "smt2") {
-        auto res{its.to_its()};
-        for (unsigned i = 0; i < res.childCount(); ++i) {
-            if (indent) {
-                std::cout << res.getChild(i).toString();
+    }};
+    // the targets that are written to stdout are written in the given order by a single task, each file by its own
+    std::vector<std::vector<const Target*>> tasks(1);
+    for (auto &t: targets) {
+        if (!t.path.empty()) {
+            struct stat st;
+            const auto exists {::lstat(t.path.c_str(), &st) == 0};
+            if (exists && !S_ISREG(st.st_mode)) {
+                // devices, pipes, and symbolic links are written in place
+                t.fd = ::open(t.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
             } else {
-                std::cout << res.getChild(i).toCompactString();
+                t.temp_path = t.path + "." + std::to_string(getpid()) + ".tmp";
+                t.fd = ::open(t.temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, exists ? st.st_mode & 07777 : 0644);
+            }
+            if (t.fd < 0) {
+                t.temp_path.clear();
+                discard_files();
+                throw std::invalid_argument("Unable to open file: " + t.path);
+            }
+            if (threads > 1) {
+                tasks.push_back({&t});
+                continue;
             }
         }
-    } else {
-        std::cout << "unknown ouput format " << to << std::endl;
-        print_help();
+        tasks.front().push_back(&t);
+    }
+    // the task for stdout is empty if all targets are written to files, and must not get a share of the threads
+    std::erase_if(tasks, [](const std::vector<const Target*> &task) {
+        return task.empty();
+    });
+    // the serializers only read the ITS, so the formats can be written concurrently, and each of them splits its share
+    // of the threads among ranges of rules
+    const auto task_threads {std::max<unsigned>(threads / tasks.size(), 1)};
+    const auto output {[&](const auto &its) {
+        parallel::for_each_index(tasks.size(), [&](const size_t i) {
+            for (const auto t: tasks[i]) {
+                Sink sink(t->fd);
+                if (t->format == "koat") {
+                    its.write_koat(sink, task_threads);
+                } else {
+                    SexpWriter writer(sink, indent);
+                    if (t->format == "ari") {
+                        its.write_ari(writer, task_threads);
+                    } else {
+                        its.write_its(writer, task_threads);
+                    }
+                }
+                sink.finish();
+            }
+        });
+    }};
+    try {
+        if (flat) {
+            const FlatITS flat_its(its);
+            report("flattening");
+            output(flat_its);
+        } else {
+            output(its);
+        }
+        report("output");
+        for (auto &t: targets) {
+            // close may report write errors that were deferred
+            if (!t.path.empty() && ::close(std::exchange(t.fd, -1)) != 0) {
+                throw std::invalid_argument("Unable to write file: " + t.path);
+            }
+        }
+    } catch (...) {
+        discard_files();
+        throw;
+    }
+    for (auto &t: targets) {
+        if (!t.temp_path.empty()) {
+            if (std::rename(t.temp_path.c_str(), t.path.c_str()) != 0) {
+                discard_files();
+                throw std::invalid_argument("Unable to write file: " + t.path);
+            }
+            t.temp_path.clear();
+        }
     }
 }
@@ -0,0 +1,73 @@
+#include "mappedfile.hpp"
+
+#include <stdexcept>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+    // closes the file descriptor when the constructor returns or throws
+    struct FdGuard {
+        int fd;
+        ~FdGuard() {
+            close(fd);
+        }
+    };
+
+}
+
+MappedFile::MappedFile(const std::string &filename) {
+    const auto fd {open(filename.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd < 0) {
+        throw std::invalid_argument("Unable to open file: " + filename);
+    }
+    const FdGuard guard {fd};
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *addr {mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+        if (addr != MAP_FAILED) {
+            // the parsers read the input exactly once from front to back
+            madvise(addr, st.st_size, MADV_SEQUENTIAL);
+            madvise(addr, st.st_size, MADV_WILLNEED);
+            data = static_cast<const char*>(addr);
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    if (!mapped) {
+        read(fd);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (mapped) {
+        munmap(const_cast<char*>(data), size);
+    }
+}
+
+void MappedFile::read(int fd) {
+    constexpr size_t chunk {1 << 16};
+    size_t len {0};
+    while (true) {
+        buffer.resize(len + chunk);
+        const auto n {::read(fd, buffer.data() + len, chunk)};
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            throw std::invalid_argument("Unable to read file");
+        } else if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    buffer.resize(len);
+    data = buffer.data();
+    size = len;
+}
+
+std::string_view MappedFile::view() const {
+    return {data, size};
+}
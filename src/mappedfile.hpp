@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+/**
+ * Read-only view of the content of a file.
+ *
+ * Regular files are memory-mapped, so that parsers can run directly on the bytes of the file.
+ * Everything else (pipes, character devices, ...) cannot be mapped and is read into a buffer instead.
+ */
+class MappedFile {
+
+    const char *data {nullptr};
+    size_t size {0};
+    bool mapped {false};
+    std::string buffer;
+
+    void read(int fd);
+
+public:
+
+    explicit MappedFile(const std::string &filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const;
+
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+    // chunks of the input that are smaller than this are not worth a thread of their own
+    constexpr size_t min_chunk_size {1 << 20};
+
+    /**
+     * the number of chunks that an input of the given size should be split into, if up to threads threads are available
+     */
+    inline size_t chunks(const size_t size, const unsigned threads) {
+        return std::clamp<size_t>(size / min_chunk_size, 1, std::max(threads, 1u));
+    }
+
+    /**
+     * Runs f(0), ..., f(n-1) concurrently, where f(0) runs on the calling thread, and waits until all of them are done.
+     * If some of them throw, the exception thrown by the one with the smallest index is rethrown.
+     */
+    template <class F>
+    void for_each_index(const size_t n, F &&f) {
+        std::vector<std::exception_ptr> errors(n);
+        const auto run {[&](const size_t i) {
+            try {
+                f(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }};
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < n; ++i) {
+            workers.emplace_back(run, i);
+        }
+        if (n > 0) {
+            run(0);
+        }
+        for (auto &w: workers) {
+            w.join();
+        }
+        for (const auto &e: errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+    }
+
+}
@@ -1,7 +1,8 @@
 #include "parser.hpp"
 #include "util.hpp"
+#include "mappedfile.hpp"
+#include "parallel.hpp"
 
-#include <fstream>
 #include <boost/algorithm/string.hpp>
 #include <iostream>
 
@@ -9,37 +10,45 @@ namespace sexpressionparser {
 
     typedef Parser Self;
 
-    ITS Self::loadFromFile(const std::string &filename) {
+    ITS Self::loadFromFile(const std::string &filename, const unsigned threads, const bool preserve_shape) {
         Parser parser;
-        parser.run(filename);
-        return parser.res;
+        parser.run(filename, threads, preserve_shape);
+        return std::move(parser.res);
     }
 
-    void Self::run(const std::string &filename) {
-        std::ifstream ifs(filename);
-        std::string content(
-                (std::istreambuf_iterator<char>(ifs)),
-                (std::istreambuf_iterator<char>()));
-        sexpresso::Sexp sexp = sexpresso::parse(content);
-        for (auto &ex: sexp.arguments()) {
-            if (ex[0].str() == "define-fun") {
-                if (ex[1].str() == "init_main") {
+    void Self::run(const std::string &filename, const unsigned threads, const bool preserve_shape) {
+        const MappedFile file(filename);
+        res.arena->preserve_shape = preserve_shape;
+        const ArenaScope scope(*res.arena);
+        sexpresso::Reader reader(file.view());
+        // top-level forms are materialized one at a time, and the transitions of next_main in independent chunks
+        while (reader.peek().kind == sexpresso::EventKind::OPEN) {
+            reader.next();
+            if (reader.peek().str() == "define-fun") {
+                reader.next();
+                const auto name {reader.next()};
+                if (name.str() == "init_main") {
                     // the initial state
-                    sexpresso::Sexp &init = ex[4];
+                    sexpresso::Sexp scope, type, init;
+                    reader.read(scope);
+                    reader.read(type);
+                    reader.read(init);
                     // we do not support conditions regarding the initial state
                     assert(init[3].str() == "true");
-                    res.init = init[2].str();
-                } else if (ex[1].value.str == "next_main") {
-                    std::vector<std::string> pre_vars;
+                    res.init = Symbol(init[2].str());
+                } else if (name.str() == "next_main") {
+                    std::vector<Symbol> pre_vars;
                     std::vector<Expr> post_vars;
-                    sexpresso::Sexp &scope = ex[2];
+                    sexpresso::Sexp scope, type;
+                    reader.read(scope);
+                    reader.read(type);
                     bool pre {true};
                     for (sexpresso::Sexp &e: scope.arguments()) {
                         if (e[1].str() == "Int") {
                             if (pre) {
-                                pre_vars.push_back(e[0].str());
+                                pre_vars.emplace_back(e[0].str());
                             } else {
-                                post_vars.push_back(Expr(e[0].str()));
+                                post_vars.push_back(Expr(Symbol(e[0].str())));
                             }
                         } else if (e[1].str() == "Loc") {
                             assert(pre);
@@ -47,64 +56,143 @@ namespace sexpressionparser {
                         }
                     }
                     assert(pre_vars.size() == post_vars.size());
-                    sexpresso::Sexp ruleExps = ex[4];
-                    for (auto &ruleExp: ruleExps.arguments()) {
-                        if (ruleExp[0].str() == "cfg_trans2") {
-                            Lhs lhs;
-                            Rhs rhs;
-                            lhs.location = ruleExp[2].str();
-                            lhs.args = pre_vars;
-                            rhs.location = ruleExp[4].str();
-                            rhs.args = post_vars;
-                            const auto cond {parseCond(ruleExp[5])};
-                            const auto rule {Rule(lhs, rhs, cond)};
-                            res.rules.push_back(rule);
+                    if (reader.peek().kind == sexpresso::EventKind::OPEN) {
+                        reader.next();
+                        sexpresso::Sexp disj;
+                        // skip the disjunction symbol
+                        reader.read(disj);
+                        // the transitions are independent, so they are parsed in chunks concurrently
+                        const auto input {reader.rest()};
+                        const auto chunks {sexpresso::splitElements(input, parallel::chunks(input.size(), threads))};
+                        std::vector<ITS> parts(chunks.size());
+                        parallel::for_each_index(chunks.size(), [&](const size_t i) {
+                            parts[i].arena->preserve_shape = preserve_shape;
+                            const ArenaScope scope(*parts[i].arena);
+                            parseTransitions(chunks[i], pre_vars, post_vars, parts[i]);
+                        });
+                        for (auto &part: parts) {
+                            res.append(std::move(part));
                         }
+                        reader = sexpresso::Reader(input.substr(chunks.back().data() + chunks.back().size() - input.data()));
+                        reader.next();
                     }
                 }
             }
+            reader.skipRest();
+        }
+        if (reader.peek().kind != sexpresso::EventKind::END) {
+            throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "unbalanced parentheses" : reader.error()));
         }
     }
 
-    Formula Self::parseCond(sexpresso::Sexp &sexp) {
-        if (sexp.isString()) {
-            if (sexp.str() == "false") {
-                return False;
-            } else {
-                assert(sexp.str() == "true");
-                return True;
+    void Self::parseTransitions(std::string_view input, const std::vector<Symbol> &pre_vars, const std::vector<Expr> &post_vars, ITS &its) {
+        sexpresso::Reader reader(input);
+        sexpresso::Sexp ruleExp;
+        while (reader.read(ruleExp)) {
+            if (ruleExp[0].str() == "cfg_trans2") {
+                // every rule owns its arguments, so the variables have to be copied
+                Rule rule;
+                rule.lhs.location = Symbol(ruleExp[2].str());
+                rule.lhs.args = pre_vars;
+                rule.rhs.location = Symbol(ruleExp[4].str());
+                rule.rhs.args = post_vars;
+                rule.cond = parseCond(ruleExp[5]);
+                its.add_rule(std::move(rule));
             }
         }
-        const std::string op = sexp[0].str();
-        if (op == "and") {
-            std::vector<Formula> args;
-            for (unsigned int i = 1; i < sexp.childCount(); i++) {
-                args.push_back(parseCond(sexp[i]));
+        if (reader.peek().kind != sexpresso::EventKind::END) {
+            throw std::invalid_argument("parsing failed: " + (reader.error().empty() ? "unbalanced parentheses" : reader.error()));
+        }
+    }
+
+    // parseCond and parseExpression use explicit stacks, so that the nesting depth is not limited by the stack
+
+    Formula Self::parseCond(sexpresso::Sexp &sexp) {
+        enum class Kind {
+            And, Exists, Not
+        };
+        // the applications whose arguments are not complete yet, with the position of their first argument in args resp.
+        // of their first variable in vars, and the range of the children that remain to be parsed
+        struct Frame {
+            sexpresso::Sexp *app;
+            Kind kind;
+            size_t first;
+            size_t first_var;
+            size_t next;
+            size_t end;
+        };
+        // the stacks are reused by all calls on this thread to avoid allocations
+        thread_local std::vector<Frame> todo;
+        thread_local std::vector<Formula> args;
+        thread_local std::vector<Symbol> vars;
+        todo.clear();
+        args.clear();
+        vars.clear();
+        auto cur {&sexp};
+        // the argument of a negation is a constraint, which cannot be a conjunction or a quantifier
+        bool constraint {false};
+        while (cur) {
+            if (constraint) {
+                if (cur->childCount() == 2) {
+                    assert((*cur)[0].str() == "not");
+                    todo.push_back({cur, Kind::Not, args.size(), vars.size(), 1, 2});
+                } else {
+                    args.push_back(parseConstraint(*cur));
+                }
+            } else if (cur->isString()) {
+                if (cur->str() == "false") {
+                    args.push_back(False);
+                } else {
+                    assert(cur->str() == "true");
+                    args.push_back(True);
+                }
+            } else if (const auto op {(*cur)[0].str()}; op == "and") {
+                todo.push_back({cur, Kind::And, args.size(), vars.size(), 1, cur->childCount()});
+            } else if (op == "exists") {
+                const auto first_var {vars.size()};
+                auto &scope {(*cur)[1]};
+                for (unsigned i = 0; i < scope.childCount(); ++i) {
+                    vars.emplace_back(scope[i][0].str());
+                }
+                todo.push_back({cur, Kind::Exists, args.size(), first_var, 2, 3});
+            } else {
+                constraint = true;
+                continue;
             }
-            return mk_and(args);
-        } else if (op == "exists") {
-            sexpresso::Sexp scope = sexp[1];
-            Exists ex;
-            for (unsigned i = 0; i < scope.childCount(); ++i) {
-                ex.vars.push_back(scope[i][0].str());
+            cur = nullptr;
+            while (!cur && !todo.empty()) {
+                auto &f {todo.back()};
+                if (f.next < f.end) {
+                    cur = &(*f.app)[f.next++];
+                    constraint = f.kind == Kind::Not;
+                    continue;
+                }
+                Formula res;
+                switch (f.kind) {
+                    case Kind::And:
+                        res = mk_and(std::span<const Formula>{args.data() + f.first, args.size() - f.first});
+                        break;
+                    case Kind::Exists:
+                        res = mk_exists(std::span<const Symbol>{vars.data() + f.first_var, vars.size() - f.first_var}, args.back());
+                        break;
+                    case Kind::Not:
+                        res = mk_not(args.back());
+                        break;
+                }
+                args.erase(args.begin() + f.first, args.end());
+                vars.erase(vars.begin() + f.first_var, vars.end());
+                args.push_back(res);
+                todo.pop_back();
             }
-            ex.matrix = std::make_shared<Formula>(parseCond(sexp[2]));
-            return ex;
-        } else {
-            return parseConstraint(sexp);
         }
-
+        return args.back();
     }
 
     Formula Self::parseConstraint(sexpresso::Sexp &sexp) {
-        if (sexp.childCount() == 2) {
-            assert(sexp[0].str() == "not");
-            return mk_not(parseConstraint(sexp[1]));
-        }
         assert(sexp.childCount() == 3);
-        const std::string &op {sexp[0].str()};
-        const auto fst {parseExpression(sexp[1])};
-        const auto snd {parseExpression(sexp[2])};
+        const auto op {sexp[0].str()};
+        auto fst {parseExpression(sexp[1])};
+        auto snd {parseExpression(sexp[2])};
         RelOp rop;
         if (op == "<=") {
             rop = RelOp::Leq;
@@ -119,38 +207,70 @@ namespace sexpressionparser {
         } else {
             throw std::invalid_argument("unknown relation");
         }
-        return Formula(Rel{fst, rop, snd});
+        return Formula(Rel{std::move(fst), rop, std::move(snd)});
     }
 
     Expr Self::parseExpression(sexpresso::Sexp &sexp) {
-        if (sexp.childCount() == 1) {
-            const auto &str {sexp.str()};
-            if (is_int(str)) {
-                return Expr(stol(str));
+        // the applications whose arguments are not complete yet, with the position of their first argument in args and
+        // the range of the children that remain to be parsed
+        struct Frame {
+            sexpresso::Sexp *app;
+            size_t first;
+            size_t next;
+            size_t end;
+        };
+        thread_local std::vector<Frame> todo;
+        thread_local std::vector<Expr> args;
+        todo.clear();
+        args.clear();
+        auto cur {&sexp};
+        while (cur) {
+            if (cur->childCount() == 1) {
+                const auto str {cur->str()};
+                if (is_int(str)) {
+                    args.emplace_back(stol(std::string{str}));
+                } else {
+                    args.emplace_back(Symbol(str));
+                }
+            } else if (cur->childCount() == 0) {
+                throw std::invalid_argument("unknown operator");
             } else {
-                return Expr(str);
+                // only binary operators and unary minus are supported, but the first argument is parsed anyway
+                todo.push_back({cur, args.size(), 1, cur->childCount() == 3 ? size_t{3} : size_t{2}});
             }
-        }
-        const auto &op {sexp[0].str()};
-        const auto fst {parseExpression(sexp[1])};
-        if (sexp.childCount() == 3) {
-            const auto snd {parseExpression(sexp[2])};
-            ArithOp aop;
-            if (op == "+") {
-                aop = ArithOp::Plus;
-            } else if (op == "-") {
-                aop = ArithOp::Minus;
-            } else if (op == "*") {
-                aop = ArithOp::Times;
-            } else {
-                throw std::invalid_argument("unknown arithmetic operator");
+            cur = nullptr;
+            while (!cur && !todo.empty()) {
+                auto &f {todo.back()};
+                if (f.next < f.end) {
+                    cur = &(*f.app)[f.next++];
+                    continue;
+                }
+                const auto op {(*f.app)[0].str()};
+                Expr res;
+                if (f.app->childCount() == 3) {
+                    ArithOp aop;
+                    if (op == "+") {
+                        aop = ArithOp::Plus;
+                    } else if (op == "-") {
+                        aop = ArithOp::Minus;
+                    } else if (op == "*") {
+                        aop = ArithOp::Times;
+                    } else {
+                        throw std::invalid_argument("unknown arithmetic operator");
+                    }
+                    res = mk_arith_app(aop, args[f.first], args[f.first + 1]);
+                } else if (f.app->childCount() == 2) {
+                    assert(op == "-");
+                    res = mk_unary_minus(args.back());
+                } else {
+                    throw std::invalid_argument("unknown operator");
+                }
+                args.erase(args.begin() + f.first, args.end());
+                args.push_back(res);
+                todo.pop_back();
             }
-            return mk_arith_app(aop, {fst, snd});
-        } else if (sexp.childCount() == 2) {
-            assert(op == "-");
-            return mk_unary_minus(fst);
         }
-        throw std::invalid_argument("unknown operator");
+        return args.back();
     }
 
 }
@@ -8,10 +8,17 @@ namespace sexpressionparser {
     class Parser {
 
     public:
-        static ITS loadFromFile(const std::string &filename);
+        /**
+         * Large files are parsed by up to threads threads. The resulting ITS preserves the shape of its input if
+         * preserve_shape is set.
+         */
+        static ITS loadFromFile(const std::string &filename, const unsigned threads = 1, const bool preserve_shape = false);
 
     private:
-        void run(const std::string &filename);
+        void run(const std::string &filename, const unsigned threads, const bool preserve_shape);
+
+        // adds the transitions to its, whose arena has to be the current one
+        void parseTransitions(std::string_view input, const std::vector<Symbol> &pre_vars, const std::vector<Expr> &post_vars, ITS &its);
 
         Formula parseCond(sexpresso::Sexp &sexp);
 
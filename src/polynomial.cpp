@@ -0,0 +1,269 @@
+#include "polynomial.hpp"
+#include "traversal.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+    long checked_add(const long x, const long y) {
+        long res;
+        if (__builtin_add_overflow(x, y, &res)) {
+            throw std::invalid_argument("overflow while normalizing an expression");
+        }
+        return res;
+    }
+
+    long checked_mul(const long x, const long y) {
+        long res;
+        if (__builtin_mul_overflow(x, y, &res)) {
+            throw std::invalid_argument("overflow while normalizing an expression");
+        }
+        return res;
+    }
+
+    Monomial multiply(const Monomial &x, const Monomial &y) {
+        Monomial res;
+        res.reserve(x.size() + y.size());
+        auto i {x.begin()};
+        auto j {y.begin()};
+        while (i != x.end() && j != y.end()) {
+            if (i->first == j->first) {
+                res.emplace_back(i->first, checked_add(i->second, j->second));
+                ++i;
+                ++j;
+            } else if (by_name(i->first, j->first)) {
+                res.push_back(*i++);
+            } else {
+                res.push_back(*j++);
+            }
+        }
+        res.insert(res.end(), i, x.end());
+        res.insert(res.end(), j, y.end());
+        return res;
+    }
+
+    Expr to_expr(const Monomial &m, const long c) {
+        std::vector<Expr> factors;
+        if (c != 1 || m.empty()) {
+            factors.emplace_back(c);
+        }
+        for (const auto &[x,e]: m) {
+            factors.push_back(e == 1 ? Expr{x} : mk_pow(x, e));
+        }
+        return factors.size() == 1 ? factors.front() : mk_times(factors);
+    }
+
+}
+
+bool Polynomial::less(const Term &x, const Term &y) {
+    if (x.degree != y.degree) {
+        return x.degree > y.degree;
+    }
+    const auto &mx {x.monomial};
+    const auto &my {y.monomial};
+    return std::lexicographical_compare(mx.begin(), mx.end(), my.begin(), my.end(), [](const auto &a, const auto &b) {
+        if (a.first != b.first) {
+            return by_name(a.first, b.first);
+        }
+        return a.second > b.second;
+    });
+}
+
+Polynomial::Polynomial(const long c) {
+    if (c != 0) {
+        terms.push_back(Term{{}, 0, c});
+    }
+}
+
+Polynomial::Polynomial(const Symbol x) {
+    terms.push_back(Term{{{x, 1}}, 1, 1});
+}
+
+Polynomial::Polynomial(const Expr &e) {
+    // Sums are not canonicalized right away, but only when they are multiplied and at the end. Otherwise, each +
+    // would copy and sort its arguments, which is quadratic for long sums.
+    *this = traversal::fold<Polynomial>(e, [](const Expr &e, std::span<Polynomial> args) {
+        if (std::holds_alternative<long>(e)) {
+            return Polynomial(std::get<long>(e));
+        } else if (std::holds_alternative<Symbol>(e)) {
+            return Polynomial(std::get<Symbol>(e));
+        }
+        const auto app {std::get<ArithAppPtr>(e)};
+        Polynomial res;
+        switch (app->op) {
+            case ArithOp::Plus:
+            case ArithOp::Minus:
+                if (!args.empty()) {
+                    // the first argument is usually the largest one in nested sums, so it is extended in place
+                    res = std::move(args.front());
+                    for (auto &arg: args.subspan(1)) {
+                        if (app->op == ArithOp::Minus) {
+                            arg = -arg;
+                        }
+                        res.terms.insert(res.terms.end(), std::make_move_iterator(arg.terms.begin()), std::make_move_iterator(arg.terms.end()));
+                    }
+                }
+                break;
+            case ArithOp::Times:
+                res = Polynomial(1);
+                for (auto &arg: args) {
+                    arg.canonicalize();
+                    res = res * arg;
+                }
+                break;
+            case ArithOp::UnaryMinus:
+                res = -args.front();
+                break;
+            case ArithOp::Pow:
+                args.front().canonicalize();
+                res = args.front().pow(std::get<long>(app->args.back()));
+                break;
+        }
+        return res;
+    });
+    canonicalize();
+}
+
+void Polynomial::canonicalize() {
+    std::sort(terms.begin(), terms.end(), less);
+    std::vector<Term> res;
+    for (auto &t: terms) {
+        if (!res.empty() && res.back().monomial == t.monomial) {
+            res.back().coeff = checked_add(res.back().coeff, t.coeff);
+        } else {
+            if (!res.empty() && res.back().coeff == 0) {
+                res.pop_back();
+            }
+            res.push_back(std::move(t));
+        }
+    }
+    if (!res.empty() && res.back().coeff == 0) {
+        res.pop_back();
+    }
+    terms = std::move(res);
+}
+
+Polynomial Polynomial::operator+(const Polynomial &that) const {
+    // both are canonical, so their terms can be merged
+    Polynomial res;
+    res.terms.reserve(terms.size() + that.terms.size());
+    auto i {terms.begin()};
+    auto j {that.terms.begin()};
+    while (i != terms.end() && j != that.terms.end()) {
+        if (less(*i, *j)) {
+            res.terms.push_back(*i++);
+        } else if (less(*j, *i)) {
+            res.terms.push_back(*j++);
+        } else {
+            const auto c {checked_add(i->coeff, j->coeff)};
+            if (c != 0) {
+                res.terms.push_back(Term{i->monomial, i->degree, c});
+            }
+            ++i;
+            ++j;
+        }
+    }
+    res.terms.insert(res.terms.end(), i, terms.end());
+    res.terms.insert(res.terms.end(), j, that.terms.end());
+    return res;
+}
+
+Polynomial Polynomial::operator-(const Polynomial &that) const {
+    return *this + -that;
+}
+
+Polynomial Polynomial::operator*(const Polynomial &that) const {
+    Polynomial res;
+    res.terms.reserve(terms.size() * that.terms.size());
+    for (const auto &[m1,d1,c1]: terms) {
+        for (const auto &[m2,d2,c2]: that.terms) {
+            res.terms.push_back(Term{multiply(m1, m2), checked_add(d1, d2), checked_mul(c1, c2)});
+        }
+    }
+    res.canonicalize();
+    return res;
+}
+
+Polynomial Polynomial::operator-() const {
+    Polynomial res {*this};
+    for (auto &t: res.terms) {
+        t.coeff = checked_mul(t.coeff, -1);
+    }
+    return res;
+}
+
+Polynomial Polynomial::pow(long exponent) const {
+    // repeated squaring
+    Polynomial res(1);
+    auto square {*this};
+    while (exponent > 0) {
+        if (exponent & 1) {
+            res = res * square;
+        }
+        exponent >>= 1;
+        if (exponent > 0) {
+            square = square * square;
+        }
+    }
+    return res;
+}
+
+long Polynomial::degree() const {
+    // the terms are sorted by descending degree
+    return terms.empty() ? 0 : terms.front().degree;
+}
+
+bool Polynomial::is_linear() const {
+    return degree() <= 1;
+}
+
+Expr Polynomial::to_expr() const {
+    std::vector<Expr> positive, negative;
+    for (const auto &[m,_,c]: terms) {
+        if (c > 0) {
+            positive.push_back(::to_expr(m, c));
+        } else {
+            negative.push_back(::to_expr(m, checked_mul(c, -1)));
+        }
+    }
+    if (positive.empty() && negative.empty()) {
+        return 0L;
+    }
+    std::vector<Expr> args;
+    if (positive.empty()) {
+        const auto &[m,_,c] {terms.front()};
+        args.push_back(c == -1 && !m.empty() ? mk_unary_minus(::to_expr(m, 1)) : ::to_expr(m, c));
+        negative.erase(negative.begin());
+    } else {
+        args.push_back(positive.size() == 1 ? positive.front() : mk_plus(positive));
+    }
+    if (negative.empty()) {
+        return args.front();
+    }
+    args.insert(args.end(), negative.begin(), negative.end());
+    return mk_minus(args);
+}
+
+Expr normalize(const Expr &e) {
+    return Polynomial(e).to_expr();
+}
+
+Formula normalize(const Formula &f) {
+    return traversal::fold<Formula>(f, [](const Formula &f, std::span<Formula> args) -> Formula {
+        if (const auto rel {std::get_if<Rel>(&f)}) {
+            return Rel{normalize(rel->lhs), rel->op, normalize(rel->rhs)};
+        }
+        return traversal::rebuild(f, args);
+    });
+}
+
+void normalize(ITS &its) {
+    const ArenaScope scope(*its.arena);
+    for (auto &r: its.take_rules()) {
+        for (auto &arg: r.rhs.args) {
+            arg = normalize(arg);
+        }
+        r.cond = normalize(r.cond);
+        its.add_rule(std::move(r));
+    }
+}
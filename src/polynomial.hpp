@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+
+#include "its.hpp"
+
+/**
+ * A product of variables, where each variable occurs once with a positive exponent, and the variables are sorted by
+ * name.
+ */
+using Monomial = std::vector<std::pair<Symbol, long>>;
+
+/**
+ * A polynomial with integer coefficients in a canonical sparse representation: a list of monomials with non-zero
+ * coefficients, sorted by descending degree and then lexicographically, so that equal polynomials have equal
+ * representations.
+ */
+class Polynomial {
+
+    struct Term {
+        Monomial monomial;
+        // the degree of the monomial, so that sorting does not have to recompute it
+        long degree;
+        long coeff;
+
+        bool operator==(const Term&) const = default;
+    };
+
+    std::vector<Term> terms;
+
+    // descending by degree, then lexicographically
+    static bool less(const Term &x, const Term &y);
+
+    // sorts the terms, adds up the coefficients of equal monomials, and removes monomials with coefficient 0
+    void canonicalize();
+
+public:
+
+    Polynomial() = default;
+    explicit Polynomial(const long c);
+    explicit Polynomial(const Symbol x);
+    /**
+     * throws std::invalid_argument if a coefficient does not fit into a long
+     */
+    explicit Polynomial(const Expr &e);
+
+    Polynomial operator+(const Polynomial &that) const;
+    Polynomial operator-(const Polynomial &that) const;
+    Polynomial operator*(const Polynomial &that) const;
+    Polynomial operator-() const;
+    Polynomial pow(long exponent) const;
+
+    bool operator==(const Polynomial&) const = default;
+
+    long degree() const;
+    bool is_linear() const;
+
+    /**
+     * the sum of the terms with positive coefficients minus the terms with negative coefficients, so that the koat
+     * format, which ignores precedences when printing, does not change its meaning
+     */
+    Expr to_expr() const;
+
+};
+
+/**
+ * replaces all expressions by their normal forms, in the arena of the current thread
+ */
+Expr normalize(const Expr &e);
+Formula normalize(const Formula &f);
+void normalize(ITS &its);
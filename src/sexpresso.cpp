@@ -12,16 +12,19 @@
 #include <string>
 #include <cstdint>
 #include <cctype>
-#include <stack>
 #include <algorithm>
-#include <sstream>
+#include <stdexcept>
 #include <array>
+#include <bit>
 #include <assert.h>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace sexpresso {
     Sexp::Sexp() {
         this->kind = SexpValueKind::SEXP;
-        this->count = 2; // for parantheses
     }
     Sexp::Sexp(std::string const& strval) {
         this->kind = SexpValueKind::STRING;
@@ -31,21 +34,37 @@ namespace sexpresso {
     Sexp::Sexp(std::vector<Sexp> const& sexpval) {
         this->kind = SexpValueKind::SEXP;
         this->value.sexp = sexpval;
-        for (const auto &x: sexpval) {
-            count += x.count;
+    }
+
+    Sexp::~Sexp() {
+        // moves the nested lists of each child to todo, so that each of them is destroyed when it has no nested lists
+        // anymore
+        auto todo = std::vector<Sexp>{};
+        const auto moveNested = [&todo](Sexp& sexp) {
+            for(auto& child : sexp.value.sexp) {
+                if(!child.value.sexp.empty()) todo.push_back(std::move(child));
+            }
+        };
+        for(auto& child : this->value.sexp) {
+            moveNested(child);
+            while(!todo.empty()) {
+                auto sexp = std::move(todo.back());
+                todo.pop_back();
+                moveNested(sexp);
+            }
         }
-        count += sexpval.size() - 1; // for whitespace
-        count += 2; // for parantheses
     }
 
     auto Sexp::addChild(Sexp sexp) -> void {
         if(this->kind == SexpValueKind::STRING) {
             this->kind = SexpValueKind::SEXP;
-            this->value.sexp.emplace_back(Sexp{this->value.str});
+            if (this->value.view.data()) {
+                this->value.sexp.emplace_back(Sexp::borrowed(this->value.view));
+            } else {
+                this->value.sexp.emplace_back(Sexp{this->value.str});
+            }
         }
         this->value.sexp.push_back(std::move(sexp));
-        count += sexp.count;
-        ++count; // for whitespace
     }
 
     auto Sexp::addChild(std::string str) -> void {
@@ -99,14 +118,14 @@ namespace sexpresso {
                 auto brk = false;
                 switch(child.kind) {
                     case SexpValueKind::STRING:
-                        if(i == paths.end() - 1 && child.value.str == *i) return &child;
+                        if(i == paths.end() - 1 && child.str() == *i) return &child;
                         else continue;
                     case SexpValueKind::SEXP:
                         if(child.value.sexp.empty()) continue;
                         auto& fst = child.value.sexp[0];
                         switch(fst.kind) {
                             case SexpValueKind::STRING:
-                                if(fst.value.str == *i) {
+                                if(fst.str() == *i) {
                                     cur = &child;
                                     ++i;
                                     brk = true;
@@ -175,148 +194,185 @@ namespace sexpresso {
         return getChild(idx);
     }
 
-    auto Sexp::str() -> std::string& {
+    auto Sexp::str() const -> std::string_view {
+        if (this->value.view.data()) {
+            return this->value.view;
+        }
         return this->value.str;
     }
 
     static const std::array<char, 11> escape_chars = { '"',  '?', '\\',  'a',  'b',  'f',  'n',  'r',  't',  'v' };
     static const std::array<char, 11> escape_vals  = { '"', '\?', '\\', '\a', '\b', '\f', '\n', '\r', '\t', '\v' };
 
+    // whether a character is one of escape_vals, as a table, since printing checks every character of every atom
+    static const auto escapeValues = [] {
+        auto res = std::array<bool, 256>{};
+        for(auto c : escape_vals) res[static_cast<unsigned char>(c)] = true;
+        return res;
+    }();
+
     static auto isEscapeValue(char c) -> bool {
-        return std::find(escape_vals.begin(), escape_vals.end(), c) != escape_vals.end();
+        return escapeValues[static_cast<unsigned char>(c)];
     }
 
-    static auto countEscapeValues(std::string const& str) -> long {
+    static auto countEscapeValues(std::string_view str) -> long {
         return std::count_if(str.begin(), str.end(), isEscapeValue);
     }
 
-    static auto stringValToString(std::string const& s) -> std::string {
+    auto isVerbatim(std::string_view s) -> bool {
+        return !s.empty() && std::none_of(s.begin(), s.end(), [](char c) { return c == ' ' || isEscapeValue(c); });
+    }
+
+    auto stringValToString(std::string_view s) -> std::string {
         if(s.empty()) return std::string{"\"\""};
-        if((std::find(s.begin(), s.end(), ' ') == s.end()) && countEscapeValues(s) == 0) return s;
+        if(isVerbatim(s)) return std::string{s};
         return ('"' + escape(s) + '"');
     }
 
-    bool needsParantheses(Sexp const &sexp) {
-        return sexp.isSexp() && (sexp.childCount() > 1 || (sexp.childCount() == 1 && sexp.value.sexp.front().isSexp()));
+    Printer::Printer(std::string& out, bool indent): out(out), indent(indent) {}
+
+    auto Printer::newline(size_t indent) -> void {
+        out.push_back('\n');
+        if(this->indent) out.append(indent, ' ');
     }
 
-    static auto toStringImpl(Sexp const &sexp, std::ostringstream &ostream, unsigned indent, bool freshline) -> bool {
-        switch (sexp.kind) {
-        case SexpValueKind::STRING:
-            ostream << stringValToString(sexp.value.str);
-            return false;
-        case SexpValueKind::SEXP:
-            if (sexp.count > 80) {
-                if (!freshline) {
-                    ostream << '\n';
-                    for (unsigned i = 0; i < indent; ++i) {
-                        ostream << ' ';
-                    }
-                }
-                indent += 2;
-                if (needsParantheses(sexp)) {
-                    ostream << '(';
-                }
-                auto i = sexp.value.sexp.begin();
-                freshline = toStringImpl(*i, ostream, indent, false);
-                for (++i; i != sexp.value.sexp.end(); ++i) {
-                    if (!freshline) {
-                        ostream << '\n';
-                        for (unsigned i = 0; i < indent; ++i) {
-                            ostream << ' ';
-                        }
-                    }
-                    freshline = toStringImpl(*i, ostream, indent, true);
-                }
-                if (needsParantheses(sexp)) {
-                    ostream << ')';
-                }
-                indent -= 2;
-                ostream << '\n';
-                for (unsigned i = 0; i < indent; ++i) {
-                    ostream << ' ';
-                }
-                return true;
+    auto Printer::beginChild() -> bool {
+        if(frames.empty()) return true;
+        auto const& parent = frames.back();
+        if(parent.broken) {
+            // the first child follows the opening parenthesis, the others start on a fresh line
+            if(parent.index == 0) return false;
+            if(!parent.fresh) newline(parent.indent + 2);
+            return true;
+        }
+        if(parent.index > 0 && !parent.fresh) out.push_back(' ');
+        return parent.fresh;
+    }
+
+    auto Printer::endChild(bool fresh) -> void {
+        if(frames.empty()) {
+            if(!fresh) out.push_back('\n');
+        } else {
+            auto& parent = frames.back();
+            parent.fresh = fresh;
+            ++parent.index;
+        }
+    }
+
+    auto Printer::atom(std::string_view printed) -> void {
+        beginChild();
+        out.append(printed);
+        endChild(false);
+    }
+
+    auto Printer::open(size_t width, size_t children, bool firstIsList) -> void {
+        auto const fresh = beginChild();
+        auto const indent = frames.empty() ? 0 : frames.back().indent + 2;
+        auto const frame = Frame{width > maxWidth, children > 1 || (children == 1 && firstIsList), false, indent, 0};
+        if(frame.broken && !fresh) newline(indent);
+        if(frame.parens) out.push_back('(');
+        frames.push_back(frame);
+    }
+
+    auto Printer::close() -> void {
+        auto const frame = frames.back();
+        frames.pop_back();
+        if(frame.parens) out.push_back(')');
+        if(frame.broken) newline(frame.indent);
+        endChild(frame.broken);
+    }
+
+    auto Printer::flat() const -> bool {
+        return !frames.empty() && !frames.back().broken;
+    }
+
+    auto Printer::fork(std::string& out) const -> Printer {
+        auto res = Printer{out, this->indent};
+        res.frames = this->frames;
+        if(!res.frames.empty()) {
+            assert(res.frames.back().index > 0);
+            // join writes the separator, as it depends on how the previous child ended
+            res.frames.back().index = 1;
+            res.frames.back().fresh = true;
+        }
+        return res;
+    }
+
+    auto Printer::join(Printer const& part) -> void {
+        if(frames.empty()) return;
+        auto const& last = part.frames.back();
+        if(last.index == 1) return;
+        beginChild();
+        auto& parent = frames.back();
+        parent.index += last.index - 1;
+        parent.fresh = last.fresh;
+    }
+
+    auto Printer::print(Sexp const& sexp) -> void {
+        // the lists that are currently open, with the index of their next child
+        auto todo = std::vector<std::pair<Sexp const*, size_t>>{};
+        auto const visit = [&](Sexp const& s) {
+            if(s.isString()) {
+                auto const str = s.str();
+                if(isVerbatim(str)) atom(str);
+                else atom(stringValToString(str));
             } else {
-                if (needsParantheses(sexp)) {
-                    ostream << '(';
-                }
-                auto freshline = false;
-                for (auto i = sexp.value.sexp.begin(); i != sexp.value.sexp.end(); ++i) {
-                    freshline = toStringImpl(*i, ostream, indent + 2, freshline);
-                    if (!freshline && i != sexp.value.sexp.end() - 1) {
-                        ostream << ' ';
-                    }
-                }
-                if (needsParantheses(sexp)) {
-                    ostream << ')';
-                }
-                return false;
+                auto const& children = s.value.sexp;
+                open(flat() ? 0 : s.width(maxWidth + 1), children.size(), !children.empty() && children.front().isSexp());
+                todo.emplace_back(&s, 0);
+            }
+        };
+        visit(sexp);
+        while(!todo.empty()) {
+            auto& [s, next] = todo.back();
+            if(next == s->value.sexp.size()) {
+                todo.pop_back();
+                close();
+            } else {
+                visit(s->value.sexp[next++]);
             }
         }
-        return false;
     }
 
-    static auto toCompactStringImpl(Sexp const &sexp, std::ostringstream &ostream, bool freshline) -> bool {
-        switch (sexp.kind) {
-        case SexpValueKind::STRING:
-            ostream << stringValToString(sexp.value.str);
-            return false;
-        case SexpValueKind::SEXP:
-            if (sexp.count > 80) {
-                if (!freshline) {
-                    ostream << '\n';
-                }
-                if (needsParantheses(sexp)) {
-                    ostream << '(';
-                }
-                auto i = sexp.value.sexp.begin();
-                freshline = toCompactStringImpl(*i, ostream, false);
-                for (++i; i != sexp.value.sexp.end(); ++i) {
-                    if (!freshline) {
-                        ostream << '\n';
-                    }
-                    freshline = toCompactStringImpl(*i, ostream, true);
-                }
-                if (needsParantheses(sexp)) {
-                    ostream << ')';
-                }
-                ostream << '\n';
-                return true;
+    auto Sexp::width(size_t cap) const -> size_t {
+        if(this->isString()) return this->count;
+        // each step adds at least one, so at most cap nodes are visited
+        auto res = size_t{2};
+        // reused, as this is called for most lists while printing
+        thread_local auto todo = std::vector<std::pair<Sexp const*, size_t>>{};
+        todo.clear();
+        todo.emplace_back(this, 0);
+        while(!todo.empty() && res < cap) {
+            auto& [s, next] = todo.back();
+            if(next == s->value.sexp.size()) {
+                todo.pop_back();
+                continue;
+            }
+            auto const& child = s->value.sexp[next++];
+            if(child.isString()) {
+                res += child.count + 1;
             } else {
-                if (needsParantheses(sexp)) {
-                    ostream << '(';
-                }
-                auto freshline = false;
-                for (auto i = sexp.value.sexp.begin(); i != sexp.value.sexp.end(); ++i) {
-                    freshline = toCompactStringImpl(*i, ostream, freshline);
-                    if (!freshline && i != sexp.value.sexp.end() - 1) {
-                        ostream << ' ';
-                    }
-                }
-                if (needsParantheses(sexp)) {
-                    ostream << ')';
-                }
-                return false;
+                res += 3;
+                todo.emplace_back(&child, 0);
             }
         }
-        return false;
+        return std::min(res, cap);
+    }
+
+    auto Sexp::print(std::string& out, bool indent) const -> void {
+        Printer{out, indent}.print(*this);
     }
 
     auto Sexp::toString() const -> std::string {
-        auto ostream = std::ostringstream{};
-        if (!toStringImpl(*this, ostream, 0, true)) {
-            ostream << std::endl;
-        }
-        return ostream.str();
+        auto out = std::string{};
+        this->print(out, true);
+        return out;
     }
 
     auto Sexp::toCompactString() const -> std::string {
-        auto ostream = std::ostringstream{};
-        if (!toCompactStringImpl(*this, ostream, true)) {
-            ostream << std::endl;
-        }
-        return ostream.str();
+        auto out = std::string{};
+        this->print(out, false);
+        return out;
     }
 
     auto Sexp::isString() const -> bool {
@@ -346,7 +402,7 @@ namespace sexpresso {
             case SexpValueKind::SEXP:
                 return childrenEqual(this->value.sexp, other.value.sexp);
             case SexpValueKind::STRING:
-                return this->value.str == other.value.str;
+                return this->str() == other.str();
         }
         throw std::invalid_argument("unknown SexpValueKind");
     }
@@ -358,108 +414,329 @@ namespace sexpresso {
     auto Sexp::unescaped(std::string strval) -> Sexp {
         auto s = Sexp{};
         s.kind = SexpValueKind::STRING;
+        s.count = strval.size();
         s.value.str = std::move(strval);
         return s;
     }
 
-    auto parse(std::string const& str, std::string& err) -> Sexp {
-        auto sexprstack = std::stack<Sexp>{};
-        sexprstack.push(Sexp{}); // root
-        auto nextiter = str.begin();
-        for(auto iter = nextiter; iter != str.end(); iter = nextiter) {
-            nextiter = iter + 1;
-            if(std::isspace(*iter)) continue;
+    auto Sexp::borrowed(std::string_view strval) -> Sexp {
+        auto s = Sexp{};
+        s.kind = SexpValueKind::STRING;
+        s.value.view = strval;
+        s.count = strval.size();
+        return s;
+    }
+
+    auto Event::str() const -> std::string_view {
+        if(this->owned) return this->unescaped;
+        return this->text;
+    }
+
+    // The tokenizer mostly searches for the next byte of some character class, e.g., the end of a symbol. Instead of
+    // testing byte by byte, blocks of 64 bytes are classified at once into bitmasks, where bit i refers to the i-th byte
+    // of the block. Whitespace is what std::isspace considers whitespace in the C locale.
+    static constexpr auto block_size = size_t{64};
+
+#if defined(__AVX2__)
+    struct Block {
+        __m256i lo, hi;
+        explicit Block(char const* p):
+            lo(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(p))),
+            hi(_mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + 32))) {}
+        static auto bits(__m256i m) -> uint64_t { return static_cast<uint32_t>(_mm256_movemask_epi8(m)); }
+        static auto spaces(__m256i v) -> uint64_t {
+            // '\t' to '\r' are detected by moving them to the bottom of the signed range
+            auto const shifted = _mm256_xor_si256(_mm256_sub_epi8(v, _mm256_set1_epi8('\t')), _mm256_set1_epi8(-128));
+            auto const ctrl = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 5), shifted);
+            return bits(_mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))));
+        }
+        auto eq(char c) const -> uint64_t {
+            auto const v = _mm256_set1_epi8(c);
+            return bits(_mm256_cmpeq_epi8(lo, v)) | bits(_mm256_cmpeq_epi8(hi, v)) << 32;
+        }
+        auto space() const -> uint64_t { return spaces(lo) | spaces(hi) << 32; }
+    };
+#elif defined(__SSE2__)
+    struct Block {
+        __m128i v[4];
+        explicit Block(char const* p) {
+            for(auto i = size_t{0}; i < 4; ++i) this->v[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(p + 16 * i));
+        }
+        static auto bits(__m128i m) -> uint64_t { return static_cast<uint16_t>(_mm_movemask_epi8(m)); }
+        static auto spaces(__m128i v) -> uint64_t {
+            // '\t' to '\r' are detected by moving them to the bottom of the signed range
+            auto const shifted = _mm_xor_si128(_mm_sub_epi8(v, _mm_set1_epi8('\t')), _mm_set1_epi8(-128));
+            auto const ctrl = _mm_cmpgt_epi8(_mm_set1_epi8(-128 + 5), shifted);
+            return bits(_mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+        }
+        auto eq(char c) const -> uint64_t {
+            auto const e = _mm_set1_epi8(c);
+            auto res = uint64_t{0};
+            for(auto i = size_t{0}; i < 4; ++i) res |= bits(_mm_cmpeq_epi8(this->v[i], e)) << (16 * i);
+            return res;
+        }
+        auto space() const -> uint64_t {
+            auto res = uint64_t{0};
+            for(auto i = size_t{0}; i < 4; ++i) res |= spaces(this->v[i]) << (16 * i);
+            return res;
+        }
+    };
+#else
+    struct Block {
+        char const* p;
+        explicit Block(char const* p): p(p) {}
+        template<typename P>
+        auto classify(P pred) const -> uint64_t {
+            auto res = uint64_t{0};
+            for(auto i = size_t{0}; i < block_size; ++i) res |= uint64_t{pred(this->p[i])} << i;
+            return res;
+        }
+        auto eq(char c) const -> uint64_t { return this->classify([c](char d) { return c == d; }); }
+        auto space() const -> uint64_t {
+            return this->classify([](char c) { return c == ' ' || static_cast<unsigned char>(c - '\t') < 5; });
+        }
+    };
+#endif
+
+    static auto classify(std::string_view str, size_t offset) -> BlockIndex {
+        auto padded = std::array<char, block_size>{};
+        auto data = str.data() + offset;
+        auto valid = ~uint64_t{0};
+        if(str.size() - offset < block_size) {
+            // the last block is padded with zeros, and only the bits of the actual input are taken into account
+            std::copy(data, str.data() + str.size(), padded.begin());
+            data = padded.data();
+            valid = (uint64_t{1} << (str.size() - offset)) - 1;
+        }
+        auto const block = Block{data};
+        auto const space = block.space();
+        auto const newline = block.eq('\n');
+        auto res = BlockIndex{};
+        res.offset = offset;
+        res.nonSpace = ~space & valid;
+        res.symbolEnd = (space | block.eq(')')) & valid;
+        res.bar = block.eq('|') & valid;
+        res.stringDelimiter = (block.eq('"') | block.eq('\\') | newline) & valid;
+        res.lineEnd = (newline | block.eq('\r')) & valid;
+        return res;
+    }
+
+    // The offset of the first byte at or after from that belongs to the given class, or str.size(). Blocks are aligned
+    // relative to the beginning of str, and the most recently classified one is cached in index, as consecutive
+    // searches usually end in the same block.
+    static auto findFirst(std::string_view str, size_t from, BlockIndex& index, uint64_t BlockIndex::* cls) -> size_t {
+        auto const size = str.size();
+        while(from < size) {
+            auto const offset = from - from % block_size;
+            if(index.offset != offset) index = classify(str, offset);
+            auto const mask = (index.*cls) >> (from - offset);
+            if(mask != 0) return from + std::countr_zero(mask);
+            from = offset + block_size;
+        }
+        return size;
+    }
+
+    Reader::Reader(std::string_view str, bool inplace): input(str), pos(str.begin()), inplace(inplace) {}
+
+    auto Reader::peek() -> Event const& {
+        if(!this->lookahead) {
+            this->event = this->scan();
+            this->lookahead = true;
+        }
+        return this->event;
+    }
+
+    auto Reader::next() -> Event {
+        this->peek();
+        this->lookahead = false;
+        return std::move(this->event);
+    }
+
+    auto Reader::error() const -> std::string const& {
+        return this->err;
+    }
+
+    auto Reader::rest() const -> std::string_view {
+        return std::string_view{this->pos, this->input.end()};
+    }
+
+    auto Reader::fail(std::string msg) -> Event {
+        this->err = std::move(msg);
+        return Event{EventKind::ERROR};
+    }
+
+    auto Reader::scan() -> Event {
+        if(!this->err.empty()) return Event{EventKind::ERROR};
+        auto const begin = this->input.begin();
+        auto const end = this->input.end();
+        while(true) {
+            this->pos = begin + findFirst(this->input, this->pos - begin, this->block, &BlockIndex::nonSpace);
+            if(this->pos == end) break;
+            auto iter = this->pos++;
             switch(*iter) {
                 case '(':
-                    sexprstack.push(Sexp{});
-                    break;
-                case ')': {
-                    auto topsexp = std::move(sexprstack.top());
-                    sexprstack.pop();
-                    if(sexprstack.empty()) {
-                        err = std::string{"too many ')' characters detected, closing sexprs that don't exist, no good."};
-                        return Sexp{};
-                    }
-                    auto& top = sexprstack.top();
-                    top.addChild(std::move(topsexp));
-                    break;
-                }
+                    return Event{EventKind::OPEN};
+                case ')':
+                    return Event{EventKind::CLOSE};
                 case '"': {
-                    auto i = iter+1;
-                    auto start = i;
-                    for(; i != str.end(); ++i) {
-                        if(*i == '\\') { ++i; continue; }
+                    auto start = iter+1;
+                    auto i = start;
+                    while(true) {
+                        i = begin + findFirst(this->input, i - begin, this->block, &BlockIndex::stringDelimiter);
+                        if(i == end) return this->fail("Unterminated string literal");
                         if(*i == '"') break;
-                        if(*i == '\n') {
-                            err = std::string{"Unexpected newline in string literal"};
-                            return Sexp{};
-                        }
-                    }
-                    if(i == str.end()) {
-                        err = std::string{"Unterminated string literal"};
-                        return Sexp{};
+                        if(*i == '\n') return this->fail("Unexpected newline in string literal");
+                        // skip the escaped character
+                        i += end - i > 1 ? 2 : 1;
                     }
-                    auto resultstr = std::string{};
-                    resultstr.reserve(i - start);
+                    this->pos = i + 1;
+                    auto ev = Event{EventKind::ATOM, true, false, std::string_view{start, i}};
+                    if(std::find(start, i, '\\') == i) return ev;
+                    ev.owned = true;
+                    ev.unescaped.reserve(i - start);
                     for(auto it = start; it != i; ++it) {
                         switch(*it) {
                             case '\\': {
                                 ++it;
-                                if(it == i) {
-                                    err = std::string{"Unfinished escape sequence at the end of the string"};
-                                    return Sexp{};
-                                }
-                                auto pos = std::find(escape_chars.begin(), escape_chars.end(), *it);
-                                if(pos == escape_chars.end()) {
-                                    err = std::string{"invalid escape char '"} + *it + '\'';
-                                    return Sexp{};
-                                }
-                                resultstr.push_back(escape_vals[pos - escape_chars.begin()]);
+                                if(it == i) return this->fail("Unfinished escape sequence at the end of the string");
+                                auto loc = std::find(escape_chars.begin(), escape_chars.end(), *it);
+                                if(loc == escape_chars.end()) return this->fail(std::string{"invalid escape char '"} + *it + '\'');
+                                ev.unescaped.push_back(escape_vals[loc - escape_chars.begin()]);
                                 break;
                             }
                             default:
-                                resultstr.push_back(*it);
+                                ev.unescaped.push_back(*it);
                         }
                     }
-                    sexprstack.top().addChildUnescaped(std::move(resultstr));
-                    nextiter = i + 1;
-                    break;
+                    return ev;
                 }
                 case ';':
-                    for(; nextiter != str.end() && *nextiter != '\n' && *nextiter != '\r'; ++nextiter) {}
-                    for(; nextiter != str.end() && (*nextiter == '\n' || *nextiter == '\r'); ++nextiter) {}
+                    this->pos = begin + findFirst(this->input, this->pos - begin, this->block, &BlockIndex::lineEnd);
+                    for(; this->pos != end && (*this->pos == '\n' || *this->pos == '\r'); ++this->pos) {}
                     break;
                 case '|': {
                     ++iter;
-                    auto symend = std::find_if(iter, str.end(), [](char const& c) { return c == '|'; });
-                    auto& top = sexprstack.top();
-                    top.addChild(Sexp{std::string{iter, symend}});
-                    nextiter = std::next(symend);
-                    break;
+                    auto symend = begin + findFirst(this->input, iter - begin, this->block, &BlockIndex::bar);
+                    if(symend == end) return this->fail("Unterminated quoted symbol");
+                    this->pos = symend + 1;
+                    return Event{EventKind::ATOM, false, false, std::string_view{iter, symend}};
                 }
                 default: {
-                    auto symend = std::find_if(iter, str.end(), [](char const& c) { return std::isspace(c) || c == ')'; });
-                    auto& top = sexprstack.top();
-                    top.addChild(Sexp{std::string{iter, symend}});
-                    nextiter = symend;
+                    auto symend = begin + findFirst(this->input, iter - begin, this->block, &BlockIndex::symbolEnd);
+                    this->pos = symend;
+                    return Event{EventKind::ATOM, false, false, std::string_view{iter, symend}};
                 }
             }
         }
-        if(sexprstack.size() != 1) {
-            err = std::string{"not enough s-expressions were closed by the end of parsing"};
+        return Event{EventKind::END};
+    }
+
+    auto Reader::atom(Event&& ev) const -> Sexp {
+        if(ev.owned) return Sexp::unescaped(std::move(ev.unescaped));
+        if(this->inplace) return Sexp::borrowed(ev.text);
+        if(ev.quoted) return Sexp::unescaped(std::string{ev.text});
+        return Sexp{std::string{ev.text}};
+    }
+
+    auto Reader::read(Sexp& out) -> bool {
+        switch(this->peek().kind) {
+            case EventKind::ATOM:
+                out = this->atom(this->next());
+                return true;
+            case EventKind::OPEN:
+                break;
+            default:
+                return false;
+        }
+        auto sexprstack = std::vector<Sexp>{};
+        while(true) {
+            auto ev = this->next();
+            switch(ev.kind) {
+                case EventKind::OPEN:
+                    sexprstack.emplace_back();
+                    break;
+                case EventKind::ATOM:
+                    sexprstack.back().addChild(this->atom(std::move(ev)));
+                    break;
+                case EventKind::CLOSE: {
+                    auto topsexp = std::move(sexprstack.back());
+                    sexprstack.pop_back();
+                    if(sexprstack.empty()) {
+                        out = std::move(topsexp);
+                        return true;
+                    }
+                    sexprstack.back().addChild(std::move(topsexp));
+                    break;
+                }
+                case EventKind::END:
+                    this->err = std::string{"not enough s-expressions were closed by the end of parsing"};
+                    return false;
+                case EventKind::ERROR:
+                    return false;
+            }
+        }
+    }
+
+    auto Reader::skipRest() -> void {
+        for(auto depth = 0u;;) {
+            switch(this->next().kind) {
+                case EventKind::OPEN:
+                    ++depth;
+                    break;
+                case EventKind::CLOSE:
+                    if(depth == 0) return;
+                    --depth;
+                    break;
+                case EventKind::ATOM:
+                    break;
+                case EventKind::END:
+                    this->err = std::string{"not enough s-expressions were closed by the end of parsing"};
+                    return;
+                case EventKind::ERROR:
+                    return;
+            }
+        }
+    }
+
+    static auto parseImpl(std::string_view str, std::string& err, bool inplace) -> Sexp {
+        auto reader = Reader{str, inplace};
+        auto root = Sexp{};
+        auto child = Sexp{};
+        while(reader.read(child)) {
+            root.addChild(std::move(child));
+        }
+        if(reader.peek().kind == EventKind::CLOSE) {
+            err = std::string{"too many ')' characters detected, closing sexprs that don't exist, no good."};
             return Sexp{};
         }
-        return std::move(sexprstack.top());
+        if(!reader.error().empty()) {
+            err = reader.error();
+            return Sexp{};
+        }
+        return root;
     }
 
-    auto parse(std::string const& str) -> Sexp {
+    auto parse(std::string_view str, std::string& err) -> Sexp {
+        return parseImpl(str, err, false);
+    }
+
+    auto parse(std::string_view str) -> Sexp {
         auto ignored_error = std::string{};
         return parse(str, ignored_error);
     }
 
-    auto escape(std::string const& str) -> std::string {
+    auto parseInPlace(std::string_view str, std::string& err) -> Sexp {
+        return parseImpl(str, err, true);
+    }
+
+    auto parseInPlace(std::string_view str) -> Sexp {
+        auto ignored_error = std::string{};
+        return parseInPlace(str, ignored_error);
+    }
+
+    auto escape(std::string_view str) -> std::string {
         auto escape_count = countEscapeValues(str);
-        if(escape_count == 0) return str;
+        if(escape_count == 0) return std::string{str};
         auto result_str = std::string{};
         result_str.reserve(str.size() + escape_count);
         for(auto c : str) {
@@ -473,6 +750,56 @@ namespace sexpresso {
         return result_str;
     }
 
+    auto splitElements(std::string_view str, size_t parts) -> std::vector<std::string_view> {
+        auto res = std::vector<std::string_view>{};
+        auto const size = str.size();
+        parts = std::max(parts, size_t{1});
+        auto start = size_t{0};
+        auto depth = size_t{0};
+        auto i = size_t{0};
+        auto index = BlockIndex{};
+        while(i < size && (depth > 0 || str[i] != ')')) {
+            switch(str[i]) {
+                case '(':
+                    ++depth;
+                    ++i;
+                    break;
+                case ')':
+                    --depth;
+                    ++i;
+                    break;
+                case '"':
+                    for(i = findFirst(str, i + 1, index, &BlockIndex::stringDelimiter); i < size && str[i] != '"'; i = findFirst(str, i, index, &BlockIndex::stringDelimiter)) {
+                        // skip escape sequences, and ignore newlines, which are reported by the Reader
+                        i += str[i] == '\\' ? 2 : 1;
+                        i = std::min(i, size);
+                    }
+                    i = std::min(i + 1, size);
+                    break;
+                case ';':
+                    i = findFirst(str, i, index, &BlockIndex::lineEnd);
+                    break;
+                case '|': {
+                    auto const symend = findFirst(str, i + 1, index, &BlockIndex::bar);
+                    i = std::min(symend + 1, size);
+                    break;
+                }
+                default:
+                    if(std::isspace(static_cast<unsigned char>(str[i]))) {
+                        i = findFirst(str, i, index, &BlockIndex::nonSpace);
+                        continue;
+                    }
+                    i = findFirst(str, i, index, &BlockIndex::symbolEnd);
+            }
+            if(depth == 0 && res.size() + 1 < parts && i >= (res.size() + 1) * (size / parts)) {
+                res.push_back(str.substr(start, i - start));
+                start = i;
+            }
+        }
+        res.push_back(str.substr(start, i - start));
+        return res;
+    }
+
     SexpArgumentIterator::SexpArgumentIterator(Sexp& sexp) : sexp(sexp) {}
 
     auto SexpArgumentIterator::begin() -> iterator {
@@ -10,10 +10,12 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 
 namespace sexpresso {
 	enum class SexpValueKind : uint8_t { SEXP, STRING };
+	enum class EventKind : uint8_t { OPEN, ATOM, CLOSE, END, ERROR };
 
 	struct SexpArgumentIterator;
 
@@ -21,9 +23,16 @@ namespace sexpresso {
 		Sexp();
 		explicit Sexp(std::string const& strval);
 		explicit Sexp(std::vector<Sexp> const& sexpval);
+		Sexp(Sexp const&) = default;
+		Sexp(Sexp&&) = default;
+		auto operator=(Sexp const&) -> Sexp& = default;
+		auto operator=(Sexp&&) -> Sexp& = default;
+		~Sexp(); // does not recurse, so the nesting depth is not limited by the stack
         SexpValueKind kind {};
+		// the width of an atom in the layout of toString, i.e., the length of its unescaped value, see width for lists
 		unsigned count {0};
-        struct { std::vector<Sexp> sexp {}; std::string str {}; } value {};
+        // atoms either own their string or refer to the buffer they were parsed from, see parseInPlace
+        struct { std::vector<Sexp> sexp {}; std::string str {}; std::string_view view {}; } value {};
 		auto addChild(Sexp sexp) -> void;
 		auto addChild(std::string str) -> void;
 		auto addChildUnescaped(std::string str) -> void;
@@ -31,23 +40,121 @@ namespace sexpresso {
 		auto childCount() const -> size_t;
 		auto operator[](size_t idx) -> Sexp&;
 		auto getChild(size_t idx) -> Sexp&; // Call only if Sexp is a Sexp
-		auto str() -> std::string&;
+		auto str() const -> std::string_view;
 		auto getChildByPath(std::string const& path) -> Sexp*; // unsafe! careful to not have the result pointer outlive the scope of the Sexp object
 		auto createPath(std::vector<std::string> const& path) -> Sexp&;
 		auto createPath(std::string const& path) -> Sexp&;
 		auto toString() const -> std::string;
 		auto toCompactString() const -> std::string;
+		auto print(std::string& out, bool indent) const -> void; // appends toString() resp. toCompactString() to out
+		// The width of the single-line form of a list, as used by the layout of toString: 2 for the parentheses plus the
+		// width of each child and a separator. It is computed on demand, and only up to cap, as the layout only depends on
+		// whether it exceeds Printer::maxWidth.
+		auto width(size_t cap = SIZE_MAX) const -> size_t;
 		auto isString() const -> bool;
 		auto isSexp() const -> bool;
 		auto isNil() const -> bool;
 		auto equal(Sexp const& other) const -> bool;
 		auto arguments() -> SexpArgumentIterator;
 		static auto unescaped(std::string strval) -> Sexp;
+		static auto borrowed(std::string_view strval) -> Sexp; // the result must not outlive strval
 	};
 
-	auto parse(std::string const& str, std::string& err) -> Sexp;
-	auto parse(std::string const& str) -> Sexp;
-	auto escape(std::string const& str) -> std::string;
+	// Lays out s-expressions like toString resp. toCompactString (if indent is false) in a caller-supplied buffer, without
+	// building them: lists are announced with their width (see Sexp::width) and number of children, followed by their
+	// children, and closed. Lists that are wider than maxWidth are broken into one line per child. As nothing is broken
+	// inside a list that fits into a line, the widths of its descendants do not matter, so the widths only have to be
+	// computed up to maxWidth + 1 for lists whose parent is broken, which bounds the lookahead by the line width, like in
+	// Oppen's pretty printer. Each top-level element is laid out separately and ends with a line break.
+	class Printer {
+	public:
+		static constexpr size_t maxWidth = 80;
+		Printer(std::string& out, bool indent);
+		auto atom(std::string_view printed) -> void; // the atom as it is printed, see stringValToString
+		auto open(size_t width, size_t children, bool firstIsList) -> void; // firstIsList only matters for a single child
+		auto close() -> void;
+		auto print(Sexp const& sexp) -> void;
+		auto flat() const -> bool; // whether the current list fits into a line, so that widths can be passed as 0
+		// A printer for another buffer that continues the current list, so that ranges of its children can be laid out
+		// independently, e.g., concurrently. Unless it is used at the top level, the current list must already have a
+		// child. Its output has to be appended to the output of this printer after calling join.
+		auto fork(std::string& out) const -> Printer;
+		auto join(Printer const& part) -> void; // writes the separator before the output of part
+	private:
+		struct Frame {
+			bool broken;
+			bool parens;
+			bool fresh; // whether the last child ended with a line break
+			size_t indent;
+			size_t index;
+		};
+		auto beginChild() -> bool; // writes the separator before the next child, returns whether it is on a fresh line
+		auto endChild(bool fresh) -> void;
+		auto newline(size_t indent) -> void;
+		std::string& out;
+		bool indent;
+		std::vector<Frame> frames {};
+	};
+
+	auto parse(std::string_view str, std::string& err) -> Sexp;
+	auto parse(std::string_view str) -> Sexp;
+	// like parse, but atoms refer to str instead of copying it, so str has to outlive the result
+	auto parseInPlace(std::string_view str, std::string& err) -> Sexp;
+	auto parseInPlace(std::string_view str) -> Sexp;
+	auto escape(std::string_view str) -> std::string;
+	// how an atom with the (escaped) value str is printed, and whether that is str itself
+	auto stringValToString(std::string_view str) -> std::string;
+	auto isVerbatim(std::string_view str) -> bool;
+
+	// Splits str into at most parts consecutive chunks of roughly equal size that consist of complete elements, using the
+	// same lexical rules as Reader, so that the chunks can be read independently. The scan stops at the end of str or at
+	// the first unmatched closing parenthesis, so the chunks cover a prefix of str. The result is never empty.
+	auto splitElements(std::string_view str, size_t parts) -> std::vector<std::string_view>;
+
+	// a single token of an s-expression, as produced by Reader
+	struct Event {
+		EventKind kind {EventKind::END};
+		bool quoted {false}; // the atom was a string literal
+		bool owned {false}; // the atom contained escape sequences, so it had to be copied to unescaped
+		std::string_view text {}; // the atom, refers to the input of the Reader
+		std::string unescaped {};
+		auto str() const -> std::string_view;
+	};
+
+	// bitmasks of the character classes of a block of 64 bytes of the input, bit i refers to the i-th byte of the block
+	struct BlockIndex {
+		size_t offset {SIZE_MAX};
+		uint64_t nonSpace {0};
+		uint64_t symbolEnd {0}; // whitespace and ')'
+		uint64_t bar {0};
+		uint64_t stringDelimiter {0}; // '"', '\\' and '\n'
+		uint64_t lineEnd {0}; // '\n' and '\r'
+	};
+
+	// Pull-based reader that produces the tokens of its input one by one, without building a tree.
+	// Complete elements can be materialized with read, so that consumers only keep the parts of the input in memory
+	// that they are currently looking at. If inplace is true, materialized atoms refer to str (see parseInPlace).
+	class Reader {
+	public:
+		explicit Reader(std::string_view str, bool inplace = true);
+		auto peek() -> Event const&;
+		auto next() -> Event;
+		auto read(Sexp& out) -> bool; // reads the next element, returns false if the current list or the input ends instead
+		auto skipRest() -> void; // skips the remaining elements of the current list, including the closing parenthesis
+		auto error() const -> std::string const&;
+		auto rest() const -> std::string_view; // the input that has not been scanned yet, call only if nothing was peeked
+	private:
+		auto scan() -> Event;
+		auto fail(std::string msg) -> Event;
+		auto atom(Event&& ev) const -> Sexp;
+		std::string_view input;
+		std::string_view::const_iterator pos;
+		bool inplace;
+		bool lookahead {false};
+		BlockIndex block {};
+		Event event {};
+		std::string err {};
+	};
 
 	struct SexpArgumentIterator {
 		explicit SexpArgumentIterator(Sexp& sexp);
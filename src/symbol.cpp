@@ -0,0 +1,104 @@
+#include "symbol.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+    class SymbolTable {
+
+        // Names are stored in segments that are never moved, where each segment is twice as large as the previous one.
+        // So once a name has been stored, it can be read without locking.
+        static constexpr uint32_t base {1024};
+        static constexpr size_t max_segments {23};
+
+        std::array<std::atomic<std::string*>, max_segments> segments {};
+        std::shared_mutex mutex;
+        std::unordered_map<std::string_view, uint32_t> ids;
+        uint64_t size {0};
+
+        static std::pair<size_t, uint32_t> locate(const uint32_t id) {
+            const auto segment {std::bit_width(id / base + 1) - 1};
+            return {segment, id - base * ((uint32_t{1} << segment) - 1)};
+        }
+
+    public:
+
+        SymbolTable() {
+            intern("");
+        }
+
+        ~SymbolTable() {
+            for (auto &s: segments) {
+                delete[] s.load();
+            }
+        }
+
+        uint32_t intern(const std::string_view name) {
+            {
+                std::shared_lock lock(mutex);
+                const auto it {ids.find(name)};
+                if (it != ids.end()) {
+                    return it->second;
+                }
+            }
+            std::unique_lock lock(mutex);
+            const auto it {ids.find(name)};
+            if (it != ids.end()) {
+                return it->second;
+            }
+            if (size > UINT32_MAX) {
+                throw std::length_error("too many symbols");
+            }
+            const auto id {static_cast<uint32_t>(size)};
+            const auto [segment, offset] {locate(id)};
+            auto names {segments[segment].load(std::memory_order_relaxed)};
+            if (!names) {
+                names = new std::string[size_t{base} << segment];
+                segments[segment].store(names, std::memory_order_release);
+            }
+            names[offset] = name;
+            // the key refers to the stored name, whose address is stable
+            ids.emplace(names[offset], id);
+            ++size;
+            return id;
+        }
+
+        const std::string& name(const uint32_t id) const {
+            const auto [segment, offset] {locate(id)};
+            return segments[segment].load(std::memory_order_acquire)[offset];
+        }
+
+    };
+
+    SymbolTable& table() {
+        static SymbolTable table;
+        return table;
+    }
+
+}
+
+Symbol::Symbol(std::string_view name) {
+    // most lookups hit a name that has been seen before by the same thread, so they do not need to touch the lock
+    thread_local std::unordered_map<std::string_view, uint32_t> cache;
+    const auto it {cache.find(name)};
+    if (it != cache.end()) {
+        id = it->second;
+    } else {
+        id = table().intern(name);
+        cache.emplace(table().name(id), id);
+    }
+}
+
+const std::string& Symbol::name() const {
+    return table().name(id);
+}
+
+bool by_name(const Symbol x, const Symbol y) {
+    return x != y && x.name() < y.name();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * An interned identifier, i.e., an index into a global table of names.
+ *
+ * Equal names are mapped to equal symbols, so symbols can be compared and hashed as integers. Note that the order of
+ * symbols is the order in which they were interned, so output that has to be sorted alphabetically needs to be sorted
+ * via by_name. Interning and name lookup are thread-safe, where lookups do not lock.
+ */
+class Symbol {
+
+    uint32_t id {0};
+
+public:
+
+    // the symbol with the empty name
+    Symbol() = default;
+
+    explicit Symbol(std::string_view name);
+
+    const std::string& name() const;
+
+    uint32_t index() const {
+        return id;
+    }
+
+    // the inverse of index, only valid for indices of existing symbols
+    static Symbol from_index(const uint32_t index) {
+        Symbol res;
+        res.id = index;
+        return res;
+    }
+
+    bool operator==(const Symbol&) const = default;
+    auto operator<=>(const Symbol&) const = default;
+
+};
+
+bool by_name(const Symbol x, const Symbol y);
+
+template <>
+struct std::hash<Symbol> {
+    size_t operator()(const Symbol s) const {
+        return s.index();
+    }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "its.hpp"
+
+/**
+ * Traversals of expressions resp. formulas with explicit stacks, so that the depth of the terms is only limited by the
+ * heap. The traversals of formulas treat relations as leaves, so their expressions have to be traversed separately.
+ * Existential quantifiers have their matrix as only child.
+ */
+namespace traversal {
+
+    inline std::span<const Expr> children(const Expr &e) {
+        if (const auto app {std::get_if<ArithAppPtr>(&e)}) {
+            return (*app)->args;
+        }
+        return {};
+    }
+
+    inline std::span<const Formula> children(const Formula &f) {
+        if (const auto app {std::get_if<BoolAppPtr>(&f)}) {
+            return (*app)->args;
+        } else if (const auto ex {std::get_if<Exists>(&f)}) {
+            return {ex->matrix, 1};
+        }
+        return {};
+    }
+
+    /**
+     * Visits the nodes in pre-order, where the children of a node are skipped if pre returns false for it.
+     */
+    template <class T, class Pre>
+    void for_each(const T &root, Pre &&pre) {
+        std::vector<const T*> todo {&root};
+        while (!todo.empty()) {
+            const auto node {todo.back()};
+            todo.pop_back();
+            if (pre(*node)) {
+                const auto args {children(*node)};
+                for (auto it = args.rbegin(); it != args.rend(); ++it) {
+                    todo.push_back(&*it);
+                }
+            }
+        }
+    }
+
+    /**
+     * Computes post(node, results) for each node in post-order, where results are the values of post for the children
+     * of node, and returns the value for root.
+     */
+    template <class R, class T, class Post>
+    R fold(const T &root, Post &&post) {
+        if (children(root).empty()) {
+            return post(root, std::span<R>{});
+        }
+        struct Frame {
+            const T *node;
+            bool expanded;
+        };
+        // the stacks are reused by all folds with the same types on this thread to avoid allocations, where nested
+        // folds use the part above the current one
+        thread_local std::vector<Frame> todo;
+        thread_local std::vector<R> results;
+        const auto todo_base {todo.size()};
+        const auto results_base {results.size()};
+        const struct Restore {
+            size_t todo_base;
+            size_t results_base;
+            ~Restore() {
+                todo.resize(todo_base);
+                results.erase(results.begin() + results_base, results.end());
+            }
+        } restore {todo_base, results_base};
+        todo.push_back({&root, false});
+        while (todo.size() > todo_base) {
+            const auto [node, expanded] {todo.back()};
+            const auto args {children(*node)};
+            if (!expanded) {
+                todo.back().expanded = true;
+                for (auto it = args.rbegin(); it != args.rend(); ++it) {
+                    todo.push_back({&*it, false});
+                }
+            } else {
+                todo.pop_back();
+                const auto first {results.size() - args.size()};
+                auto res {post(*node, std::span<R>{results.data() + first, args.size()})};
+                results.erase(results.begin() + first, results.end());
+                results.push_back(std::move(res));
+            }
+        }
+        return std::move(results.back());
+    }
+
+    /**
+     * the node with the given children, e.g., for rewriting via fold
+     */
+    Expr rebuild(const Expr &e, std::span<const Expr> args);
+    Formula rebuild(const Formula &f, std::span<const Formula> args);
+
+}
@@ -1,6 +1,7 @@
 #include "util.hpp"
 #include <algorithm>
+#include <cctype>
 
-bool is_int(const std::string &s) {
+bool is_int(std::string_view s) {
     return !s.empty() && (s[0] == '-' || std::isdigit(s[0])) && std::all_of(std::next(s.begin()), s.end(), ::isdigit);
 }
\ No newline at end of file
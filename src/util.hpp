@@ -1,5 +1,5 @@
 #pragma once
 
-#include <string>
+#include <string_view>
 
-bool is_int(const std::string &s);
\ No newline at end of file
+bool is_int(std::string_view s);
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include "writer.hpp"
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <sys/uio.h>
+#include <unistd.h>
+
+Sink::Sink(): limit(SIZE_MAX) {}
+
+Sink::Sink(const int fd): fd(fd) {
+    buffer.reserve(capacity);
+}
+
+Sink::Sink(std::ostream &stream): stream(&stream) {
+    buffer.reserve(capacity);
+}
+
+Sink::~Sink() {
+    flush();
+}
+
+void Sink::flush() {
+    if (limit == SIZE_MAX) {
+        return;
+    }
+    if (error != 0) {
+        // the output is incomplete anyway
+        buffer.clear();
+        return;
+    }
+    if (stream) {
+        if (!stream->write(buffer.data(), buffer.size())) {
+            error = EIO;
+        }
+    } else {
+        std::string_view rest {buffer};
+        while (!rest.empty()) {
+            const auto written {::write(fd, rest.data(), rest.size())};
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                break;
+            }
+            rest.remove_prefix(written);
+        }
+    }
+    buffer.clear();
+}
+
+void Sink::write_large(const std::string_view s) {
+    if (limit == SIZE_MAX || stream || error != 0) {
+        write(s);
+        return;
+    }
+    std::array<iovec, 2> parts {{{buffer.data(), buffer.size()}, {const_cast<char*>(s.data()), s.size()}}};
+    size_t first {0};
+    while (first < parts.size()) {
+        auto written {::writev(fd, parts.data() + first, parts.size() - first)};
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            break;
+        }
+        // skips the parts that have been written completely
+        for (; first < parts.size() && static_cast<size_t>(written) >= parts[first].iov_len; ++first) {
+            written -= parts[first].iov_len;
+        }
+        if (first < parts.size()) {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + written;
+            parts[first].iov_len -= written;
+        }
+    }
+    buffer.clear();
+}
+
+void Sink::finish() {
+    flush();
+    if (error != 0) {
+        throw std::invalid_argument("Unable to write output: " + std::string{std::strerror(error)});
+    }
+}
+
+SexpWriter::SexpWriter(Sink &sink, const bool indent): sink(sink), printer(sink.data(), indent) {}
+
+SexpWriter::SexpWriter(Sink &sink, sexpresso::Printer &&printer): sink(sink), printer(std::move(printer)) {}
+
+void SexpWriter::put_atom(const std::string_view s) {
+    printer.atom(s);
+    sink.commit();
+}
+
+void SexpWriter::atom(const std::string_view s) {
+    if (sexpresso::isVerbatim(s)) {
+        put_atom(s);
+    } else {
+        put_atom(sexpresso::stringValToString(sexpresso::escape(s)));
+    }
+}
+
+void SexpWriter::open(const unsigned size, const size_t children, const bool first_is_list) {
+    printer.open(size, children, first_is_list);
+    sink.commit();
+}
+
+void SexpWriter::close() {
+    printer.close();
+    sink.commit();
+}
+
+void SexpWriter::list(std::initializer_list<std::string_view> atoms) {
+    unsigned size {2};
+    for (const auto &a: atoms) {
+        size += a.size() + 1;
+    }
+    open(size, atoms.size());
+    for (const auto &a: atoms) {
+        atom(a);
+    }
+    close();
+}
+
+void SexpWriter::write(const sexpresso::Sexp &sexp) {
+    // like sexpresso::Printer::print, but flushes the sink in between
+    std::vector<std::pair<const sexpresso::Sexp*, size_t>> todo;
+    const auto visit {[&](const sexpresso::Sexp &s) {
+        if (s.isString()) {
+            const auto str {s.str()};
+            if (sexpresso::isVerbatim(str)) {
+                put_atom(str);
+            } else {
+                put_atom(sexpresso::stringValToString(str));
+            }
+        } else {
+            const auto &children {s.value.sexp};
+            open(flat() ? 0 : s.width(max_line_size + 1), children.size(), !children.empty() && children.front().isSexp());
+            todo.emplace_back(&s, 0);
+        }
+    }};
+    visit(sexp);
+    while (!todo.empty()) {
+        auto &[s, next] {todo.back()};
+        if (next == s->value.sexp.size()) {
+            todo.pop_back();
+            close();
+        } else {
+            visit(s->value.sexp[next++]);
+        }
+    }
+}
+
+SexpWriter SexpWriter::fork(Sink &sink) const {
+    return SexpWriter(sink, printer.fork(sink.data()));
+}
+
+void SexpWriter::join(const SexpWriter &part) {
+    printer.join(part.printer);
+    sink.write_large(part.sink.data());
+}
+
+bool SexpWriter::flat() const {
+    return printer.flat();
+}
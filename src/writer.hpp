@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "sexpresso.hpp"
+#include "parallel.hpp"
+
+/**
+ * Buffered output to a file descriptor or a stream, so that serializers can write many small pieces cheaply. The buffer
+ * is flushed when it is full and on destruction. A default-constructed sink just collects its output in the buffer.
+ * After a failed write, nothing is written anymore, and finish reports the failure.
+ */
+class Sink {
+
+    static constexpr size_t capacity {1 << 16};
+
+    std::string buffer;
+    int fd {-1};
+    std::ostream *stream {nullptr};
+    // the size of the buffer that triggers a flush
+    size_t limit {capacity};
+    // the errno of the first failed write, or 0
+    int error {0};
+
+public:
+
+    Sink();
+    explicit Sink(const int fd);
+    explicit Sink(std::ostream &stream);
+    ~Sink();
+
+    Sink(const Sink&) = delete;
+    Sink& operator=(const Sink&) = delete;
+
+    void write(const std::string_view s) {
+        buffer.append(s);
+        commit();
+    }
+
+    void put(const char c) {
+        buffer.push_back(c);
+        commit();
+    }
+
+    // the buffer, for writers that append to it directly and call commit afterwards
+    std::string& data() {
+        return buffer;
+    }
+
+    void commit() {
+        if (buffer.size() >= limit) {
+            flush();
+        }
+    }
+
+    void flush();
+
+    // writes the buffer and s with a single system call, without copying s
+    void write_large(const std::string_view s);
+
+    /**
+     * flushes the buffer and throws std::invalid_argument if any write has failed, which the destructor cannot report
+     */
+    void finish();
+
+};
+
+/**
+ * Writes s-expressions to a sink in the same layout as sexpresso::Sexp::toString resp. toCompactString, but without
+ * building them: the callers announce each list with its size (see sexpresso::Sexp::width) and its number of
+ * children, then write the children, and close it. Each top-level element is laid out like a separate Sexp.
+ */
+class SexpWriter {
+
+    Sink &sink;
+    sexpresso::Printer printer;
+
+    SexpWriter(Sink &sink, sexpresso::Printer &&printer);
+
+    // writes an atom as it is printed, i.e., after escaping and quoting
+    void put_atom(const std::string_view s);
+
+public:
+
+    // lists whose size exceeds this are broken into several lines
+    static constexpr unsigned max_line_size {sexpresso::Printer::maxWidth};
+
+    SexpWriter(Sink &sink, const bool indent);
+
+    /**
+     * writes the atom that sexpresso::Sexp(std::string(s)) would be, whose size is s.size()
+     */
+    void atom(const std::string_view s);
+    /**
+     * starts a list, where first_is_list only matters for lists with a single child, which are written without
+     * parentheses unless the child is a list itself
+     */
+    void open(const unsigned size, const size_t children, const bool first_is_list = false);
+    void close();
+    // a list of atoms
+    void list(std::initializer_list<std::string_view> atoms);
+    void write(const sexpresso::Sexp &sexp);
+
+    // a writer to the given sink that continues the current list, see sexpresso::Printer::fork
+    SexpWriter fork(Sink &sink) const;
+    // writes the output of part, which has to be a fork of this writer to a default-constructed sink
+    void join(const SexpWriter &part);
+
+    /**
+     * whether the current list fits into a single line, so that the sizes of its descendants do not matter and can be
+     * passed as 0
+     */
+    bool flat() const;
+
+};
+
+/**
+ * Calls write(0, n, out), where Out is Sink or SexpWriter, which writes the elements with the indices in [0, n), but on
+ * up to threads threads: write(from, to, buffer) is called concurrently for consecutive ranges, batch by batch, and the
+ * buffers are then written to out in their original order. Thus, each element must only depend on its index, and
+ * write must not leave lists open.
+ */
+template <class Out, class F>
+void write_concurrently(Out &out, const size_t n, const unsigned threads, F &&write) {
+    // smaller ranges are not worth a thread, larger ones would need larger buffers
+    constexpr size_t min_range {1 << 8};
+    constexpr size_t max_range {1 << 12};
+    if (threads <= 1 || n < 2 * min_range) {
+        write(0, n, out);
+        return;
+    }
+    const auto range {std::clamp<size_t>((n + threads - 1) / threads, min_range, max_range)};
+    std::vector<Sink> buffers(threads);
+    std::vector<std::optional<SexpWriter>> writers(threads);
+    for (size_t begin = 0; begin < n; begin += threads * range) {
+        const auto ranges {std::min<size_t>(threads, (n - begin + range - 1) / range)};
+        parallel::for_each_index(ranges, [&](const size_t r) {
+            auto &buffer {buffers[r]};
+            buffer.data().clear();
+            const auto from {begin + r * range};
+            const auto to {std::min(from + range, n)};
+            if constexpr (std::is_same_v<Out, Sink>) {
+                write(from, to, buffer);
+            } else {
+                write(from, to, writers[r].emplace(out.fork(buffer)));
+            }
+        });
+        for (size_t r = 0; r < ranges; ++r) {
+            if constexpr (std::is_same_v<Out, Sink>) {
+                out.write_large(buffers[r].data());
+            } else {
+                out.join(*writers[r]);
+            }
+        }
+    }
+}
@@ -0,0 +1,197 @@
+/**
+ * Checks that the loaders do not copy subtrees or rules by counting allocations.
+ *
+ * The fused ari parser builds the ITS directly from the tokens, so the allocations it needs for an ITS are the baseline.
+ * Every loader may allocate the s-expressions it materializes on top of that, but nothing more. For each loader, the
+ * ITS it yields is written as ari and read again with the fused parser, so that the baseline refers to exactly the same
+ * expressions and formulas. Constant overhead is excluded by comparing inputs with n and 2n rules.
+ *
+ * The margin is small enough to catch copies of subtrees, but not necessarily of single vectors.
+ */
+
+#include "ariparser.hpp"
+#include "koat.hpp"
+#include "mappedfile.hpp"
+#include "parser.hpp"
+#include "writer.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <unistd.h>
+
+namespace {
+
+    std::atomic<size_t> allocations {0};
+
+}
+
+void* operator new(const size_t size) {
+    ++allocations;
+    if (const auto p {std::malloc(size)}) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, const size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+    size_t count(const std::function<void()> &f) {
+        const size_t before {allocations};
+        f();
+        return allocations - before;
+    }
+
+    std::string ari_input(const unsigned n) {
+        std::string res {"(format LCTRS)\n(theory Ints)\n(fun f (-> Int Int Int))\n(fun g (-> Int Int Int))\n(entrypoint f)\n"};
+        for (unsigned i = 0; i < n; ++i) {
+            const auto c {std::to_string(i)};
+            res += "(rule (f x y) (g (+ x " + c + ") (- y)) :guard (and (>= x " + c + ") (< (* 2 y) 10) (or (= x y) (> x (- y " + c + ")))))\n";
+            res += "(rule (g x y) (f (* 2 x y) (- x y " + c + ")))\n";
+        }
+        return res;
+    }
+
+    std::string koat_input(const unsigned n) {
+        std::string res {"(GOAL COMPLEXITY)\n(STARTTERM (FUNCTIONSYMBOLS f))\n(VAR x y)\n(RULES\n"};
+        for (unsigned i = 0; i < n; ++i) {
+            const auto c {std::to_string(i)};
+            res += "  f(x,y) -> g(x + " + c + ", -y) :|: x >= " + c + " && 2 * y < 10 && (x = y || x > y - " + c + ")\n";
+            res += "  g(x,y) -> f(2 * x * y, x - y - " + c + ")\n";
+        }
+        return res + ")\n";
+    }
+
+    std::string smt2_input(const unsigned n) {
+        std::string res {
+            "(declare-sort Loc 0)\n(declare-const f Loc)\n(declare-const g Loc)\n"
+            "(define-fun init_main ( (pc^0 Loc) (x Int) (y Int) ) Bool\n  (cfg_init pc^0 f true))\n"
+            "(define-fun next_main (\n  (pc^0 Loc) (x^0 Int) (y^0 Int)\n  (pc^post Loc) (x^post Int) (y^post Int)\n ) Bool\n  (or\n"};
+        for (unsigned i = 0; i < n; ++i) {
+            const auto c {std::to_string(i)};
+            res += "    (cfg_trans2 pc^0 f pc^post g (and (> x^0 " + c + ") (= x^post (- x^0 1)) (= y^post (+ y^0 (* 2 x^0)))))\n";
+            res += "    (cfg_trans2 pc^0 g pc^post f (exists ((t Int)) (and (<= x^0 " + c + ") (>= t 0) (= x^post t) (= y^post (- y^0)))))\n";
+        }
+        return res + "  )\n)\n";
+    }
+
+    struct Loader {
+        std::string name;
+        std::string extension;
+        std::function<std::string(unsigned)> input;
+        std::function<ITS(const std::string&)> load;
+        // whether the loader materializes the top-level forms of its input as s-expressions
+        bool sexps;
+        // whether the loader quantifies the free variables of each rule, which the inputs do not have
+        bool quantifies;
+    };
+
+    struct Measurement {
+        size_t loader;
+        size_t sexps;
+        size_t baseline;
+    };
+
+    class Test {
+
+        std::string prefix {(std::filesystem::temp_directory_path() / ("its-conversion-test-" + std::to_string(getpid()))).string()};
+        std::vector<std::string> files;
+
+        std::string write(const std::string &extension, const std::string &content) {
+            const auto path {prefix + "-" + std::to_string(files.size()) + extension};
+            std::ofstream(path) << content;
+            files.push_back(path);
+            return path;
+        }
+
+    public:
+
+        ~Test() {
+            for (const auto &f: files) {
+                std::filesystem::remove(f);
+            }
+        }
+
+        Measurement measure(const Loader &loader, const unsigned n) {
+            Measurement res {0, 0, 0};
+            const auto path {write(loader.extension, loader.input(n))};
+            const auto its {loader.load(path)};
+            res.loader = count([&] {
+                loader.load(path);
+            });
+            if (loader.sexps) {
+                const MappedFile file(path);
+                res.sexps = count([&] {
+                    sexpresso::Reader reader(file.view());
+                    sexpresso::Sexp sexp;
+                    while (reader.read(sexp)) {}
+                });
+            }
+            Sink sink;
+            {
+                SexpWriter writer(sink, false);
+                its.write_ari(writer);
+            }
+            const auto baseline {write(".ari", sink.data())};
+            res.baseline = count([&] {
+                AriParser::loadFromFile(baseline);
+            });
+            if (loader.quantifies) {
+                auto rules {its.get_rules()};
+                res.baseline += count([&] {
+                    for (auto &r: rules) {
+                        quantify_free_vars(r);
+                    }
+                });
+            }
+            return res;
+        }
+
+    };
+
+}
+
+int main() {
+    const std::vector<Loader> loaders {
+        {"fused ari", ".ari", ari_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path);
+        }, false, false},
+        {"generic ari", ".ari", ari_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path, true);
+        }, true, false},
+        {"koat", ".koat", koat_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, false, true},
+        {"smt2", ".smt2", smt2_input, [](const std::string &path) {
+            return sexpressionparser::Parser::loadFromFile(path);
+        }, true, false}
+    };
+    const unsigned n {500};
+    Test test;
+    bool ok {true};
+    for (const auto &loader: loaders) {
+        const auto small {test.measure(loader, n)};
+        const auto large {test.measure(loader, 2 * n)};
+        const auto allocs {large.loader - small.loader};
+        const auto sexps {large.sexps - small.sexps};
+        const auto baseline {large.baseline - small.baseline};
+        std::cout << loader.name << ": " << allocs << " allocations for " << 2 * n << " additional rules, " << sexps << " for s-expressions, " << baseline << " for the ITS" << std::endl;
+        if (allocs > sexps + baseline) {
+            std::cout << "  too many allocations, something is copied" << std::endl;
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
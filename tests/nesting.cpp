@@ -0,0 +1,195 @@
+/**
+ * Checks that all loaders accept deeply nested terms, which used to overflow the stack, and that the nesting survives
+ * by counting the operators in the written ITS. Nested sums are kept if the shape is preserved.
+ */
+
+#include "ariparser.hpp"
+#include "flat.hpp"
+#include "koat.hpp"
+#include "parser.hpp"
+#include "writer.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+
+    // deep enough to overflow the default stack of 8 MiB with recursive descent
+    constexpr unsigned depth {100000};
+
+    std::string repeat(const std::string &s, const unsigned n) {
+        std::string res;
+        res.reserve(s.size() * n);
+        for (unsigned i = 0; i < n; ++i) {
+            res += s;
+        }
+        return res;
+    }
+
+    // the number of occurrences of the operator op, which may be followed by a space or a line break
+    size_t occurrences(const std::string &output, const std::string &op) {
+        size_t res {0};
+        for (auto pos {output.find(op)}; pos != std::string::npos; pos = output.find(op, pos + 1)) {
+            const auto next {pos + op.size()};
+            if (next < output.size() && (output[next] == ' ' || output[next] == '\n')) {
+                ++res;
+            }
+        }
+        return res;
+    }
+
+    std::string ari_input() {
+        const auto minus {repeat("(- ", depth) + "x" + repeat(")", depth)};
+        return "(format LCTRS)\n(theory Ints)\n(fun f (-> Int Int))\n(entrypoint f)\n"
+            "(rule (f x) (f " + minus + ") :guard " + repeat("(not ", depth) + "(< x " + minus + ")" + repeat(")", depth) + ")\n"
+            "(rule (f x) (f x) :guard " + repeat("(exists ((z Int)) ", depth) + "(< x z)" + repeat(")", depth) + ")\n"
+            "(rule (f x) (f x) :guard " + repeat("(and (or ", depth / 2) + "(< x 0)" + repeat("))", depth / 2) + ")\n";
+    }
+
+    std::string koat_input() {
+        return "(GOAL COMPLEXITY)\n(STARTTERM (FUNCTIONSYMBOLS f))\n(VAR x)\n(RULES\n"
+            "  f(x) -> f(" + repeat("(", depth) + "x" + repeat(")", depth) + ")\n"
+            "  f(x) -> f(" + repeat("-(", depth) + "x" + repeat(")", depth) + ")\n"
+            "  f(x) -> f(x) :|: " + repeat("(", depth) + repeat("-(", depth) + "x" + repeat(")", depth) + " < 1" + repeat(")", depth) + "\n"
+            "  f(x) -> f(x) :|: " + repeat("(x < 1 || (x > 2 && ", depth / 2) + "x = 3" + repeat("))", depth / 2) + "\n"
+            ")\n";
+    }
+
+    std::string smt2_input() {
+        const auto minus {repeat("(- ", depth) + "x^0" + repeat(")", depth)};
+        return "(declare-sort Loc 0)\n(declare-const f Loc)\n"
+            "(define-fun init_main ( (pc^0 Loc) (x Int) ) Bool\n  (cfg_init pc^0 f true))\n"
+            "(define-fun next_main (\n  (pc^0 Loc) (x^0 Int)\n  (pc^post Loc) (x^post Int)\n ) Bool\n  (or\n"
+            "    (cfg_trans2 pc^0 f pc^post f " + repeat("(not ", depth) + "(< x^post " + minus + ")" + repeat(")", depth) + ")\n"
+            "    (cfg_trans2 pc^0 f pc^post f " + repeat("(exists ((t Int)) ", depth) + "(< x^post t)" + repeat(")", depth) + ")\n"
+            "  )\n)\n";
+    }
+
+    std::string koat_power_input() {
+        return "(GOAL COMPLEXITY)\n(STARTTERM (FUNCTIONSYMBOLS f))\n(VAR x)\n(RULES\n"
+            "  f(x) -> f(x) :|: " + repeat("(", depth) + "x" + repeat(" + 1)^2", depth) + " > 0\n"
+            ")\n";
+    }
+
+    std::string as_ari(const ITS &its) {
+        Sink sink;
+        {
+            SexpWriter writer(sink, false);
+            its.write_ari(writer);
+        }
+        return sink.data();
+    }
+
+    template <class T>
+    std::string as_smt2(const ITS &its) {
+        Sink sink;
+        {
+            SexpWriter writer(sink, false);
+            T(its).write_its(writer);
+        }
+        return sink.data();
+    }
+
+    template <class T>
+    std::string as_koat(const ITS &its) {
+        Sink sink;
+        T(its).write_koat(sink);
+        return sink.data();
+    }
+
+    std::string ari_sum_input() {
+        return "(format LCTRS)\n(theory Ints)\n(fun f (-> Int Int))\n(entrypoint f)\n"
+            "(rule (f x) (f " + repeat("(+ ", depth) + "x" + repeat(" 1)", depth) + "))\n";
+    }
+
+    std::string koat_sum_input() {
+        return "(GOAL COMPLEXITY)\n(STARTTERM (FUNCTIONSYMBOLS f))\n(VAR x)\n(RULES\n"
+            "  f(x) -> f(x" + repeat(" + 1", depth) + ")\n"
+            ")\n";
+    }
+
+    std::string smt2_sum_input() {
+        return "(declare-sort Loc 0)\n(declare-const f Loc)\n"
+            "(define-fun init_main ( (pc^0 Loc) (x Int) ) Bool\n  (cfg_init pc^0 f true))\n"
+            "(define-fun next_main (\n  (pc^0 Loc) (x^0 Int)\n  (pc^post Loc) (x^post Int)\n ) Bool\n  (or\n"
+            "    (cfg_trans2 pc^0 f pc^post f (= x^post " + repeat("(+ ", depth) + "x^0" + repeat(" 1)", depth) + "))\n"
+            "  )\n)\n";
+    }
+
+    struct Case {
+        std::string name;
+        std::string extension;
+        std::function<std::string()> input;
+        std::function<ITS(const std::string&)> load;
+        // the operators that have to occur in the written ITS, and how often
+        std::vector<std::pair<std::string, size_t>> expected;
+        std::function<std::string(const ITS&)> write {as_ari};
+    };
+
+}
+
+int main() {
+    const std::vector<Case> cases {
+        {"fused ari", ".ari", ari_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path);
+        }, {{"(-", 2 * depth}, {"(not", depth}, {"(exists", depth}, {"(and", depth / 2}, {"(or", depth / 2}}},
+        {"generic ari", ".ari", ari_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path, true);
+        }, {{"(-", 2 * depth}, {"(not", depth}, {"(exists", depth}, {"(and", depth / 2}, {"(or", depth / 2}}},
+        {"koat", ".koat", koat_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, {{"(-", 2 * depth}, {"(or", depth / 2}, {"(and", depth / 2}}},
+        {"smt2", ".smt2", smt2_input, [](const std::string &path) {
+            return sexpressionparser::Parser::loadFromFile(path);
+        }, {{"(-", depth}, {"(not", depth}, {"(exists", depth}}},
+        {"fused ari, preserved shape", ".ari", ari_sum_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path, false, 4, true);
+        }, {{"(+", depth}}},
+        {"generic ari, preserved shape", ".ari", ari_sum_input, [](const std::string &path) {
+            return AriParser::loadFromFile(path, true, 4, true);
+        }, {{"(+", depth}}},
+        {"koat, preserved shape", ".koat", koat_sum_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path, true);
+        }, {{"(+", depth}}},
+        {"smt2, preserved shape", ".smt2", smt2_sum_input, [](const std::string &path) {
+            return sexpressionparser::Parser::loadFromFile(path, 4, true);
+        }, {{"(+", depth}}},
+        // all but the two innermost powers are written via repeated squaring, with two lets each
+        {"koat, powers as smt2", ".koat", koat_power_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, {{"(let", 2 * depth - 4}}, as_smt2<const ITS&>},
+        {"koat, flat powers as smt2", ".koat", koat_power_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, {{"(let", 2 * depth - 4}}, as_smt2<FlatITS>},
+        {"koat, powers as koat", ".koat", koat_power_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, {{"^2", depth}}, as_koat<const ITS&>},
+        {"koat, flat powers as koat", ".koat", koat_power_input, [](const std::string &path) {
+            return koat::Parser::loadFromFile(path);
+        }, {{"^2", depth}}, as_koat<FlatITS>}
+    };
+    const auto prefix {(std::filesystem::temp_directory_path() / ("its-conversion-nesting-" + std::to_string(getpid()))).string()};
+    bool ok {true};
+    for (const auto &c: cases) {
+        const auto path {prefix + c.extension};
+        std::ofstream(path) << c.input();
+        std::string output;
+        try {
+            output = c.write(c.load(path));
+        } catch (const std::exception &e) {
+            std::cout << c.name << ": " << e.what() << std::endl;
+            ok = false;
+        }
+        std::filesystem::remove(path);
+        for (const auto &[op, n]: c.expected) {
+            if (const auto found {occurrences(output, op)}; found != n) {
+                std::cout << c.name << ": expected " << n << " occurrences of '" << op << "', found " << found << std::endl;
+                ok = false;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+/**
+ * Pins the canonical order of the terms of normalized expressions, and checks that normalization is idempotent and
+ * maps equivalent expressions to the same normal form.
+ */
+
+#include "arena.hpp"
+#include "polynomial.hpp"
+#include "writer.hpp"
+
+#include <iostream>
+
+namespace {
+
+    std::string to_koat(const Expr &e) {
+        Sink sink;
+        write_koat(e, sink);
+        return std::string(sink.data());
+    }
+
+    Expr plus(std::initializer_list<Expr> args) {
+        return mk_plus(std::span(args.begin(), args.end()));
+    }
+
+    Expr times(std::initializer_list<Expr> args) {
+        return mk_times(std::span(args.begin(), args.end()));
+    }
+
+    Expr minus(std::initializer_list<Expr> args) {
+        return mk_minus(std::span(args.begin(), args.end()));
+    }
+
+    bool ok {true};
+
+    void check(const std::string &name, const bool condition) {
+        if (!condition) {
+            std::cout << name << " failed" << std::endl;
+            ok = false;
+        }
+    }
+
+}
+
+int main() {
+    Arena arena;
+    const ArenaScope scope(arena);
+    const Expr x {Symbol("x")};
+    const Expr y {Symbol("y")};
+    const Expr z {Symbol("z")};
+
+    // 3 - 2*y + y*x + x^2 - z*z*z + x + x
+    const Expr e {minus({plus({3L, times({y, x}), mk_pow(x, 2), x, x}), times({2L, y}), times({z, z, z})})};
+    const auto n {normalize(e)};
+    const auto expected {"x^2 + x * y + 2 * x + 3 - z^3 - 2 * y"};
+    check("canonical order, got " + to_koat(n) + " instead of " + expected, to_koat(n) == expected);
+    check("idempotence", normalize(n) == n);
+    check("normal form of normal form", Polynomial(n) == Polynomial(e));
+
+    // the same polynomial, written differently
+    const Expr f {plus({mk_unary_minus(times({z, mk_pow(z, 2)})), times({2L, plus({x, minus({1L, y})})}), times({x, plus({x, y})}), 1L})};
+    check("commutativity and distributivity", normalize(f) == n);
+    check("cancellation", normalize(minus({e, f})) == Expr(0L));
+    check("merging sums", Polynomial(e) + Polynomial(f) == Polynomial(times({2L, e})));
+    check("merging differences", Polynomial(e) - Polynomial(f) == Polynomial());
+
+    // a long sum whose terms have to be merged
+    std::vector<Expr> terms;
+    for (long i = 0; i < 1000; ++i) {
+        terms.push_back(times({i % 7, x, i % 2 == 0 ? x : y}));
+    }
+    const auto sum {normalize(mk_plus(terms))};
+    check("long sum, got " + to_koat(sum), to_koat(sum) == "1497 * x^2 + 1500 * x * y");
+    check("long sum idempotence", normalize(sum) == sum);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+/**
+ * Checks that writing an ITS as koat and reading it again does not change its meaning, by comparing the normal forms
+ * of the ITS before and after the round trip, written as ari. The koat output ignores most precedences, so the input
+ * only contains terms whose parentheses have to survive: compound arguments of unary minus and compound bases of
+ * powers.
+ */
+
+#include "flat.hpp"
+#include "koat.hpp"
+#include "polynomial.hpp"
+#include "writer.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+
+    const std::string input {
+        "(GOAL COMPLEXITY)\n(STARTTERM (FUNCTIONSYMBOLS f))\n(VAR x y)\n(RULES\n"
+        "  f(x,y) -> f(-(x^2), -(x + y))\n"
+        "  f(x,y) -> f(-(2 * x), -(-(x)))\n"
+        "  f(x,y) -> f((-(x))^3, (-(y^2))^2) :|: -(x^2) < -(y - 1)\n"
+        "  f(x,y) -> f(y - x^2, 1 - x) :|: x^2 > y * y\n"
+        ")\n"
+    };
+
+    std::string normal_form(const std::string &path) {
+        auto its {koat::Parser::loadFromFile(path)};
+        normalize(its);
+        Sink sink;
+        {
+            SexpWriter writer(sink, false);
+            its.write_ari(writer);
+        }
+        return sink.data();
+    }
+
+    struct Case {
+        std::string name;
+        // applied to the parsed input before it is written as koat
+        std::function<void(ITS&)> prepare;
+        std::function<void(const ITS&, Sink&)> write_koat;
+    };
+
+}
+
+int main() {
+    const std::vector<Case> cases {
+        {"koat", [](ITS&) {}, [](const ITS &its, Sink &out) {
+            its.write_koat(out);
+        }},
+        {"flat koat", [](ITS&) {}, [](const ITS &its, Sink &out) {
+            FlatITS(its).write_koat(out);
+        }},
+        {"normalized koat", [](ITS &its) {
+            normalize(its);
+        }, [](const ITS &its, Sink &out) {
+            its.write_koat(out);
+        }}
+    };
+    const auto prefix {(std::filesystem::temp_directory_path() / ("its-conversion-roundtrip-" + std::to_string(getpid()))).string()};
+    const auto path {prefix + ".koat"};
+    const auto written {prefix + "-written.koat"};
+    std::ofstream(path) << input;
+    bool ok {true};
+    for (const auto &c: cases) {
+        try {
+            auto its {koat::Parser::loadFromFile(path)};
+            c.prepare(its);
+            Sink sink;
+            c.write_koat(its, sink);
+            std::ofstream(written) << sink.data();
+            const auto expected {normal_form(path)};
+            const auto found {normal_form(written)};
+            if (found != expected) {
+                std::cout << c.name << ": the round trip via\n" << sink.data() << "yields\n" << found << "instead of\n" << expected;
+                ok = false;
+            }
+        } catch (const std::exception &e) {
+            std::cout << c.name << ": " << e.what() << std::endl;
+            ok = false;
+        }
+    }
+    std::filesystem::remove(path);
+    std::filesystem::remove(written);
+    return ok ? 0 : 1;
+}